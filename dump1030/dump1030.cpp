@@ -5,11 +5,26 @@
 #include <unistd.h>
 #include <math.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <vector>
 #include <string>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "rtl-sdr.h"
 
-#define MODES_DEFAULT_RATE         2500000      /* Some RTL-SDR radios output errors with this sample rate but it is required to properly detect the SSR interrogations */
+#define MODES_DEFAULT_RATE         2500000      /* Some RTL-SDR radios output errors with this sample rate but 2 MSPS is too coarse to properly detect the SSR interrogations */
 #define MODES_DEFAULT_FREQ         1030000000   /* Ssr interrogation uplink frequency */
 #define MODES_ASYNC_BUF_NUMBER     0            /* Default value 15 */
 #define MODES_DATA_LEN             262144       /* Default value 32*16*512 = 262 144 for rtl sdr buffer size if set to 0*/
@@ -19,27 +34,481 @@
 #define NOICE_RATIO_CLOSE          0.75         /* Default value 0.9 */
 #define AMP_DIFFERENCE             10           /* Default value */
 #define AMP_DIFFERENCE_CLOSE       5           /* Default value */
+#define MODES_RING_BLOCKS          16           /* Blocks buffered between two pipeline stages, power of two */
+#define MODES_RING_POLL_US         1000         /* Stage back-off when its input ring is empty or output ring full */
+#define MODES_REPORT_CHUNK         65536        /* Bytes of output text in one report ring slot */
+#define MODES_CACHE_LINE           64
+#define MODES_MAG_SCALE            1.405        /* Scales I/Q magnitudes to full 0-255 resolution */
+#define MODES_MIN_SEGMENT          16384        /* Smallest block segment worth scanning in a separate thread */
+#define MODES_MAX_RATE             3200000      /* Highest supported sample rate, sets the longest pattern */
+#define MODES_PROFILE_BUCKETS      512          /* Latency histogram buckets, 8 per power of two nanoseconds */
+#define MODES_METRICS_REQUEST      4096         /* Bytes of a metrics HTTP request that are read */
+#define MODES_CONTROL_LINE         256          /* Longest control socket command */
+#define MODES_CONTROL_IDLE         60           /* Seconds a control client may stay silent */
+#define MODES_CONTROL_TIMEOUT      5            /* Seconds a command waits for a block boundary */
+#define MODES_MESSAGE_TYPES        7            /* Detected message types, see messageIndex */
+#define MODES_RATE_SECONDS         64           /* One second buckets of the sliding window rates, power of two */
+#define MODES_LOG_BUCKETS          32           /* Power of two buckets of the histograms */
+#define MODES_RECORD_BLOCKS        64           /* Capture blocks buffered for the recorder, power of two */
+#define MODES_RECORD_SYNC          33554432     /* Recorded bytes between flushes out of the page cache */
+#define MODES_ORDER_RUNS           4096         /* Runs of message types kept in the order log of a block */
+#define MODES_MAX_INPUTS           8            /* rtl-sdr devices or files in one process */
+#define MODES_BASELINE_PERCENTILES 8            /* Most percentiles printed in baseline mode */
+#define MODES_ADAPT_STRIDE         4            /* Every 4th sample of a block goes to the adaptive noise estimate */
+#define MODES_ADAPT_SMOOTHING      0.125        /* Share of a new estimate in the adaptive levels */
+#define MODES_ADAPT_MIN_PULSES     64           /* Accepted pulse amplitudes needed for a new pulse estimate */
+#define MODES_ADAPT_NOISE_FACTOR   3.2          /* Lowest mpa and mnf over the median magnitude, about 99.9 % of Rayleigh noise */
+#define MODES_ADAPT_PULSE_SHARE    0.25         /* mpa as a share of the median accepted pulse amplitude */
+#define MODES_ADAPT_NOISE_SHARE    0.75         /* mnf as a share of the median accepted pulse amplitude */
+#define MODES_ADAPT_CLOSE_SHARE    1.0          /* mnfc as a share of the median accepted pulse amplitude */
+#define MODES_ADAPT_MIN_NOISE      4            /* Lowest adaptive mnf, keeps quantization steps out of the noise checks */
+#define MODES_ADAPT_FRONT_SLACK    4            /* Adaptive thresholds are this much looser for candidate bits made ahead */
+#define MODES_PATTERN_LEN          (timingAt(MODES_MAX_RATE).len_s) /* Samples needed from P1 start to check the longest pattern at any rate */
 
 using namespace std;
 
-struct {
+/* Pulse timing of SSR interrogations in tenths of microseconds. Offsets are from the
+ * start of P1. */
+struct pulseTable {
+    int pulse;                      /* Width of P1, P2, P3 and short P4 */
+    int long_p4;                    /* Width of long P4 (Compatibility mode all-call) */
+    int s_p2;                       /* Mode S preamble P2 */
+    int a_p3;                       /* Mode A P3 */
+    int c_p3;                       /* Mode C P3 */
+    int p4;                         /* P4 from start of P3 */
+    int s_p6;                       /* Mode S P6, 16.25 (56 bit) or 30.25 (112 bit) microseconds long */
+    int s_p6_short;                 /* End of short P6, rounded down */
+    int s_p6_long;                  /* End of long P6, rounded down */
+    int s_edge;                     /* Left out at the ends of the P6 energy windows */
+};
+
+constexpr struct pulseTable SSR_TIMING = { 8, 16, 20, 80, 210, 20, 35, 197, 337, 5 };
+
+/* Pulse timing in samples at one sample rate */
+struct sampleTiming {
+    int w;                          /* Samples of a pulse */
+    int lw;                         /* Samples of long P4 */
+    int p2;
+    int p3a;
+    int p3c;
+    int p4a;
+    int p4c;
+    int p6;
+    int p6_short;                   /* Samples from P1 to end of short P6 */
+    int p6_long;                    /* Samples from P1 to end of long P6 */
+    int edge;
+    int len_a;                      /* Samples from P1 to end of Mode A pattern */
+    int len_c;                      /* Samples from P1 to end of Mode C pattern */
+    int len_s;                      /* Samples from P1 to end of long P6, the longest pattern */
+};
+
+/* Time to samples, rounded to nearest with halves down. The position of P1 within
+ * its first sample is unknown, so that is where a later pulse edge most likely falls. */
+constexpr int samplesAt(int tenths, int rate) {
+    return (int) (((long long) tenths * rate + 4999999) / 10000000);
+}
+
+constexpr struct sampleTiming timingAt(int rate) {
+    return {
+        samplesAt(SSR_TIMING.pulse, rate),
+        samplesAt(SSR_TIMING.long_p4, rate),
+        samplesAt(SSR_TIMING.s_p2, rate),
+        samplesAt(SSR_TIMING.a_p3, rate),
+        samplesAt(SSR_TIMING.c_p3, rate),
+        samplesAt(SSR_TIMING.a_p3 + SSR_TIMING.p4, rate),
+        samplesAt(SSR_TIMING.c_p3 + SSR_TIMING.p4, rate),
+        samplesAt(SSR_TIMING.s_p6, rate),
+        samplesAt(SSR_TIMING.s_p6_short, rate),
+        samplesAt(SSR_TIMING.s_p6_long, rate),
+        samplesAt(SSR_TIMING.s_edge, rate),
+        samplesAt(SSR_TIMING.a_p3 + SSR_TIMING.p4, rate) + samplesAt(SSR_TIMING.long_p4, rate) + 1,
+        samplesAt(SSR_TIMING.c_p3 + SSR_TIMING.p4, rate) + samplesAt(SSR_TIMING.long_p4, rate) + 1,
+        samplesAt(SSR_TIMING.s_p6_long, rate) + 1,
+    };
+}
+
+static_assert(timingAt(MODES_MAX_RATE).len_s > timingAt(MODES_MAX_RATE).len_c, "P6 is the longest pattern");
+
+/* Integer form of a ratio parameter. Float division of two amplitudes is
+ * monotonic in the numerator, so for every denominator b a ratio check is
+ * equal to comparing the numerator against the smallest value that passes.
+ * Values range 0-256, where 256 means no 8 bit numerator passes. */
+struct ratioThreshold {
+    uint16_t above[256];            /* (float) a/b > ratio    <=>  a >= above[b] */
+    uint16_t below[256];            /* (float) a/b < ratio    <=>  a < below[b] */
+    uint16_t above_int[256];        /* a/b > ratio with integer division, as in the Mode C noise check */
+};
+
+/* Streaming statistics of the detected interrogations, updated in constant time
+ * for every message in detection order. Times are in samples of the capture so
+ * files give the same results as live data. Index MODES_MESSAGE_TYPES is all
+ * message types together. */
+struct trafficStats {
+    uint32_t window[MODES_RATE_SECONDS][MODES_MESSAGE_TYPES + 1]; /* Messages in each second, ring indexed by second */
+    uint64_t second;                /* Latest second in window */
+    uint64_t last[MODES_MESSAGE_TYPES + 1];             /* Sample index of the previous message, 0 before the first */
+    uint64_t interarrival[MODES_MESSAGE_TYPES + 1][MODES_LOG_BUCKETS]; /* Bucket b counts gaps of 2^b - 2^(b+1)-1 microseconds */
+    uint64_t runs[MODES_MESSAGE_TYPES][MODES_LOG_BUCKETS]; /* Bucket b counts runs of 2^b - 2^(b+1)-1 messages of a type in a row */
+    uint64_t run_max[MODES_MESSAGE_TYPES];
+    uint64_t run_total[MODES_MESSAGE_TYPES];            /* Messages in finished runs */
+    uint64_t run_count[MODES_MESSAGE_TYPES];
+    int run_type;                   /* Type of the current run, -1 before the first message */
+    uint64_t run_length;
+    uint64_t interval;              /* Samples between printed statistics, see --stats */
+    uint64_t next_report;           /* Sample index where statistics are printed next */
+    uint64_t reported;              /* Samples processed when statistics were last printed */
+};
+
+/* Amplitudes of one baseline category, see recordMessage. Accumulated over the
+ * whole capture so memory stays the same however long it runs. */
+enum { BASELINE_PULSE, BASELINE_NF, BASELINE_NFCLOSE, BASELINE_COUNT };
+
+struct baselineHistogram {
+    uint64_t bin[256];
+    uint64_t count;
+    uint64_t sum;
+};
+
+/* Consecutive messages of one type in the order log */
+struct orderRun {
+    uint64_t first;                 /* Absolute sample index of the first and last message */
+    uint64_t last;
+    uint32_t count;
+    int code;
+};
+
+/* Order of the messages of a block as runs of one type, built in recordMessage.
+ * Fixed size, messages after the last run fits are only counted. */
+struct orderLog {
+    struct orderRun run[MODES_ORDER_RUNS];
+    uint32_t runs;
+    uint64_t lost;
+};
+
+/* Levels behind the adaptive thresholds, see adaptThresholds */
+struct adaptiveState {
+    uint64_t pending[256];          /* Pulse amplitudes of accepted messages not yet in the pulse level */
+    uint64_t pending_count;
+    uint64_t pending_since;         /* Sample index where the pulse amplitudes not yet used start */
+    float noise;                    /* Smoothed median magnitude of the blocks */
+    float pulse;                    /* Smoothed median amplitude of accepted pulses, 0 before there are enough */
+    bool started;
+    uint8_t mpa;                    /* Thresholds for the next block of the input */
+    uint8_t mnf;
+    uint8_t mnfc;
+};
+
+/* Message found by detectAt */
+struct detection {
+    int pos;                        /* Position of P1 */
+    int next;                       /* Position where scanning continues */
+    int code;                       /* Order number of the message type */
+};
+
+/* Threads scanning segments of a block for detectMode */
+struct detectorPool {
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;       /* New block to scan */
+    pthread_cond_t done_cond;       /* All segments scanned */
+    unsigned generation;            /* Incremented for every block */
+    int pending;                    /* Segments still being scanned by workers */
+
+    /* Block being scanned */
+    const uint8_t *m;
+    int start;
+    int end;
+    int segments;
+    int seglen;                     /* Multiple of 64 so segments have own candidate mask words */
+    vector<struct detection> *hits; /* Messages found in each segment */
+    int *exit;                      /* Position after the last one scanned in each segment */
+};
+
+/* Converts I/Q pairs to magnitudes, one output byte per pair */
+typedef void (*magnitudeKernel)(const unsigned char *p, uint8_t *m, uint32_t pairs);
+
+/* Sets bit j of mask for each of the n first positions where a P1 pulse is possible
+ * with the thresholds packed by packThresholds */
+typedef void (*candidateKernel)(const uint8_t *m, uint32_t n, uint64_t *mask, uint32_t thresholds);
+
+/* detectAt and scanRange instantiated for the sample rate */
+typedef int (*detectKernel)(const uint8_t *m, int i, int *next);
+typedef int (*scanKernel)(const uint8_t *m, int i, int end, vector<struct detection> *hits);
+
+/* Single-producer/single-consumer ring of fixed size blocks connecting two
+ * pipeline stages. Each ring has exactly one producer and one consumer thread,
+ * so the indexes are published with release/acquire ordering and no locks.
+ * Producer and consumer owned fields live on separate cache lines. */
+struct blockRing {
+    alignas(MODES_CACHE_LINE) std::atomic<uint32_t> head;     /* Next slot to fill, written by producer */
+    std::atomic<uint64_t> enqueued;                           /* Blocks stored in the ring */
+    std::atomic<uint64_t> dropped;                            /* Blocks lost because the ring was full */
+    std::atomic<uint64_t> full_stalls;                        /* Times the producer had to wait for a free slot */
+    std::atomic<uint32_t> max_depth;                          /* Most blocks queued at once */
+    std::atomic<bool> closed;                                 /* Producer has no more blocks */
+    alignas(MODES_CACHE_LINE) std::atomic<uint32_t> tail;     /* Next slot to process, written by consumer */
+    std::atomic<uint64_t> consumed;                           /* Blocks handed back to the producer */
+    std::atomic<uint64_t> empty_stalls;                       /* Times the consumer had to wait for a block */
+    alignas(MODES_CACHE_LINE) unsigned char *blocks;          /* capacity * block_size bytes */
+    uint32_t *length;                                         /* Valid bytes in each slot */
+    uint64_t *gap;                                            /* Data dropped just before each slot, in units of length */
+    uint64_t lost;                                            /* Data dropped since the last committed slot, producer only */
+    uint32_t block_size;
+    uint32_t capacity;
+#ifdef MODES_PROFILE
+    uint64_t *stamp;                                          /* Capture time of the data in each slot */
+    uint64_t next_stamp;                                      /* Capture time given to the next committed slot, producer only */
+#endif
+};
+
+#ifdef MODES_PROFILE
+/* Latencies measured with --profile. The stage times are measured inside one
+ * stage, the "capture to" ones from the time a block arrived from the device or
+ * file to the end of a stage. */
+enum {
+    PROF_MAGNITUDE,                 /* computeFrontEnd */
+    PROF_DETECT,                    /* detectMode */
+    PROF_OUTPUT,                    /* Statistics and handing output to the writers */
+    PROF_WRITE,                     /* Writing a chunk of output text */
+    PROF_TO_MAGNITUDE,
+    PROF_TO_DETECT,
+    PROF_TO_OUTPUT,
+    PROF_TO_WRITTEN,                /* End to end, output text written */
+    PROF_TO_EVENTS,                 /* End to end, event records written */
+    PROF_COUNT
+};
+
+/* Latency histogram. Atomics so a summary can be printed while the stages run
+ * and the magnitude stages of several inputs can add to the same one. */
+struct profileHistogram {
+    std::atomic<uint64_t> bucket[MODES_PROFILE_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;      /* Nanoseconds */
+    std::atomic<uint64_t> max;
+};
+
+#define PROFILE_NOW(var) uint64_t var = Modes.profile ? profileNow() : 0
+#define PROFILE_ADD(h, ns) do { if (Modes.profile) profileAdd(&Modes.prof[h], ns); } while (0)
+#define PROFILE_RING_STAMP(r, t) ((r)->next_stamp = (t))
+#else
+#define PROFILE_NOW(var)
+#define PROFILE_ADD(h, ns)
+#define PROFILE_RING_STAMP(r, t)
+#endif
+
+/* Pipeline stages, each running in its own thread */
+enum {
+    STAGE_READER,                   /* rtl-sdr callback or file reader */
+    STAGE_MAGNITUDE,                /* I/Q to magnitude conversion */
+    STAGE_DETECTOR,                 /* Message detection and statistics, the main thread */
+    STAGE_REPORTER,                 /* Writes output text */
+    STAGE_EVENTS,                   /* Writes event records, only with --events */
+    STAGE_RECORD,                   /* Writes raw I/Q, only with --record */
+    STAGE_COUNT
+};
+
+/* Input sample formats of --format. Multi-byte formats are in host byte order. */
+enum {
+    FORMAT_CU8,                     /* Unsigned 8 bit centred at 127, rtl-sdr */
+    FORMAT_CS8,                     /* Signed 8 bit */
+    FORMAT_CS16,                    /* Signed 16 bit */
+    FORMAT_CF32                     /* 32 bit float, full scale +-1.0 */
+};
+
+/* Event output formats of --events-format */
+enum {
+    EVENTS_JSON,                    /* JSON Lines, one object per message */
+    EVENTS_BINARY                   /* struct eventRecord in host byte order */
+};
+
+/* Detected message in the event output. Amplitudes are the highest sample of a pulse. */
+struct eventRecord {
+    uint64_t sample;                /* Absolute sample index of P1 from start of capture */
+    int64_t time_us;                /* Wall clock time of P1 in microseconds since the epoch */
+    uint8_t code;                   /* Order number of the message type */
+    uint8_t p1;
+    uint8_t p3;                     /* P3, or P2 of a Mode S preamble */
+    uint8_t p4;                     /* 0 when there is no P4 */
+    uint8_t noise;                  /* Mean of the samples between P1 and the next pulse */
+    uint8_t input;                  /* Index of the input in the order given, 0 with one input */
+    uint8_t reserved[2];
+};
+
+/* Parameters of the control socket, see controlParams */
+enum {
+    PARAM_DIFF,
+    PARAM_DIFFCLOSE,
+    PARAM_DIFFRATIO,
+    PARAM_DIFFRATIOCLOSE,
+    PARAM_DIFFRATIOP4,
+    PARAM_DIFFRATIOCLOSEP4,
+    PARAM_MPA,
+    PARAM_MNF,
+    PARAM_MNFC,
+    PARAM_GAIN,
+    PARAM_AGC,
+    CONTROL_PARAMS
+};
+
+enum { CONTROL_GET, CONTROL_SET, CONTROL_STATS, CONTROL_RESET };
+
+/* Command of the control socket, carried out by the detector between blocks */
+struct controlCommand {
+    int op;
+    bool given[CONTROL_PARAMS];     /* Parameters of CONTROL_SET */
+    double value[CONTROL_PARAMS];
+    string reply;
+};
+
+/* An rtl-sdr device or file with its own reader and magnitude stage. The inputs
+ * share the detector, its pool and the output stages. The detector takes their
+ * magnitude blocks in turn, see nextInput, and works on the one in Modes.in. */
+struct input {
+    int index;
+    char *filename;                 /* NULL for an rtl-sdr device */
+    char *name;                     /* Shown in statistics with several inputs */
+    int dev_index;
+    rtlsdr_dev_t *dev;
+    int fd;
     pthread_t reader_thread;
-    pthread_mutex_t data_mutex;     /* Mutex to synchronize buffer access. */
-    pthread_cond_t data_cond;       /* Conditional variable associated. */
+    pthread_t magnitude_thread;
+    struct blockRing ring;          /* Capture blocks waiting for magnitude conversion */
+    struct blockRing mag_ring;      /* Magnitude blocks waiting for detection, see magnitudeStage */
+    int64_t capture_start_us;       /* Wall clock time of the first sample */
+    struct timespec replay_start;   /* Monotonic time the reader started, for the replay speed */
+    bool done;                      /* Magnitude ring closed and drained */
+    uint8_t tail[MODES_PATTERN_LEN]; /* Last magnitudes of the previous block, owned by the magnitude stage */
+    std::atomic<uint32_t> thresholds; /* Candidate thresholds for the magnitude stage, see publishThresholds */
+
+    /* Detector state of the input */
+    uint32_t block_length;          /* Bytes in the block being processed */
+    uint32_t scan_start;            /* Position of the next magnitude block where scanning continues */
+    uint64_t sample_base;           /* Samples of the input before the new samples of the block being processed */
+    struct adaptiveState adapt;
+    uint64_t reported_drops;        /* Ring drops already shown to the user */
+    struct trafficStats traffic;    /* Rates, inter-arrival times and runs, see statsRecord */
+
+    /* Statistics/Results */
+    int cumulative_countm;
+    int cumulative_count_a;
+    int cumulative_count_c;
+    int cumulative_count_a_acac;
+    int cumulative_count_c_acac;
+    int cumulative_count_a_acsac;
+    int cumulative_count_c_acsac;
+    int cumulative_count_s;
+    int cumulative_count_s_short;
+    int cumulative_count_s_long;
+    int countm;
+    int count_a;
+    int count_c;
+    int count_a_acac;
+    int count_c_acac;
+    int count_a_acsac;
+    int count_c_acsac;
+    int count_s;
+    int count_s_short;              /* Mode S with 56 bit P6, see measureP6 */
+    int count_s_long;               /* Mode S with 112 bit P6 */
+};
+
+struct {
+    pthread_t reporter_thread;
+    pthread_t events_thread;
+    pthread_t metrics_thread;
+    pthread_t record_thread;
+    struct blockRing report_ring;   /* Output text waiting to be written, dropped counts bytes */
+    struct blockRing event_ring;    /* Event records waiting to be written, dropped counts events */
+    struct blockRing record_ring;   /* Capture blocks waiting to be recorded, see recordWriterStage */
+    int affinity[STAGE_COUNT];      /* CPU of each stage, -1 if not pinned */
+
+    /* Output text of the block being detected, see reportPrintf */
+    unsigned char *report_slot;
+    uint32_t report_used;
+    bool report_dropping;           /* Report ring was full, rest of the block's output is dropped */
+
+    /* Event output, see eventAppend */
+    unsigned char *event_slot;
+    uint32_t event_used;
+    bool event_dropping;
+    int events_fd;                  /* -1 without --events */
+    char *events_name;
+    int events_format;
+    bool paced;                     /* --replay paced, files are read at the sample rate */
+    bool lossless;                  /* Stages wait instead of dropping, fast replay of a file */
+
+    /* Raw I/Q recording, see recordWriterStage */
+    int record_fd;                  /* -1 without --record */
+    char *record_name;
+    uint64_t record_limit;          /* Bytes per file before rotating, 0 never rotates */
+    double record_size;             /* --record-size in megabytes */
+    double record_seconds;          /* --record-seconds */
+    std::atomic<uint64_t> record_written;
+    std::atomic<uint64_t> record_dropped; /* Bytes not recorded because the ring was full or writing failed */
+    volatile sig_atomic_t exit;     /* SIGINT or SIGTERM received, capture stops and the pipeline drains */
+#ifdef MODES_PROFILE
+    bool profile;                   /* --profile */
+    struct profileHistogram prof[PROF_COUNT];
+    std::atomic<bool> profile_print; /* SIGUSR1 received, detector prints a summary */
+#endif
+
+    /* Metrics endpoint. The detector publishes once per block with relaxed stores
+     * and the metrics thread only loads them, so scraping never waits on detection. */
+    int metrics_fd;                 /* Listening socket, -1 without --metrics */
+    char *metrics_addr;
+    std::atomic<uint64_t> metric_samples;               /* Samples detected */
+    std::atomic<uint64_t> metric_messages[MODES_MESSAGE_TYPES]; /* Messages of each type, see messageIndex */
+    std::atomic<uint64_t> metric_block_ns;              /* Detector time of the last block */
+    std::atomic<uint64_t> metric_block_samples;         /* Samples in the last block */
+    std::atomic<uint64_t> metric_busy_ns;               /* Detector time of all blocks */
+    std::atomic<int> metric_gain;                       /* Tuner gain in tenths of dB reported by the device */
+    pthread_mutex_t device_lock;    /* Device initialization and gain changes, one device at a time */
+
+    /* Control socket. The control thread hands one command at a time to the
+     * detector, which carries it out between blocks and signals the reply. */
+    int control_fd;                 /* Listening socket, -1 without --control */
+    char *control_path;
+    pthread_t control_thread;
+    pthread_mutex_t control_mutex;
+    pthread_cond_t control_cond;
+    std::atomic<bool> control_pending; /* control holds a command for the detector */
+    struct controlCommand control;
+
+    /* Inputs, see struct input */
+    struct input input[MODES_MAX_INPUTS];
+    int inputs;
+    struct input *in;               /* Input of the block being detected */
+    int next_input;                 /* Input whose turn it is in nextInput */
 
     /* Data processing related variables */
-    unsigned char *data;
-    int type;
-    uint8_t *magnitude;
     uint8_t *maglut;
-    uint32_t data_length;
-    bool data_ready;
+    int format;                     /* Input sample format, see --format */
+    uint32_t pair_bytes;            /* Bytes of one I/Q pair in the input format */
+    double mag_scale;               /* Input amplitude to 0-255 magnitude, MODES_MAG_SCALE for full scale cu8 */
+    float scale;                    /* --scale on top of the full scale of the format */
+    magnitudeKernel magnitude_kernel; /* Selected at startup based on CPU features */
+    const char *magnitude_kernel_name;
+    candidateKernel candidate_kernel;
+    const char *candidate_kernel_name;
+    uint64_t *candidates;           /* P1 candidate bitmask of the block being scanned, in its magnitude slot */
+    bool candidates_stale;          /* Bitmask was made with tighter thresholds and is recomputed */
+    uint32_t mag_block_len;         /* Bytes of magnitudes in a magnitude slot, see magnitudeStage */
+    detectKernel detect_at;         /* Selected for the sample rate, see selectDetector */
+    scanKernel scan_range;
+    struct sampleTiming timing;     /* Pulse offsets at the sample rate */
+    struct detectorPool pool;
+    int threads;                    /* Threads scanning a block, including the detector thread */
+    struct baselineHistogram baseline[BASELINE_COUNT]; /* Baseline mode amplitudes of accepted messages */
+    uint32_t data_length;           /* Capture block / file window size in bytes */
 
     /* User definable variables */
     float diffratio;
     float diffratioclose;
     float diffratiop4;
     float diffratioclosep4;
+    struct ratioThreshold thr_diffratio;    /* Ratios above in integer form, see populateRatioTables */
+    struct ratioThreshold thr_diffratioclose;
+    struct ratioThreshold thr_diffratiop4;
+    struct ratioThreshold thr_diffratioclosep4;
     uint8_t diff;
     uint8_t diffclose;
     bool print_order;
@@ -47,6 +516,9 @@ struct {
     uint8_t min_peak_amp;
     uint8_t max_noicefloor_close;
     bool baselinemode; /* Calculates averages of detected messages based on value type and outputs them for later use as a baseline values */
+    bool adaptive;                  /* mpa, mnf and mnfc follow the signal levels, see --adaptive */
+    float bl_percentile[MODES_BASELINE_PERCENTILES]; /* Printed baseline percentiles in ascending order, see --blpercentiles */
+    int bl_percentiles;
     bool print_detected;
     bool downlink; /* True means that it is scanning for uplink signals while false is scanning for downlink replys. NOT IN USE */
     int samplerate;
@@ -54,34 +526,16 @@ struct {
     bool continuous;
 
     /* Statistics/Results */
-    int cumulative_countm;
-    int cumulative_count_a;
-    int cumulative_count_c;
-    int cumulative_count_a_acac;
-    int cumulative_count_c_acac;
-    int cumulative_count_a_acsac;
-    int cumulative_count_c_acsac;
-    int cumulative_count_s;
-    int countm;
-    int count_a;
-    int count_c;
-    int count_a_acac;
-    int count_c_acac;
-    int count_a_acsac;
-    int count_c_acsac;
-    int count_s;
-    unsigned char *order;
+    struct orderLog order;          /* Order of messages of the block, see --order */
+    double stats_interval;          /* Seconds between traffic statistics, 0 if not printed */
 
 
     /* Test file handling */
-    int fd;
-    char *filename;
+    char *filename;                 /* First --file, NULL with rtl-sdr devices */
 
 
     /* RTL-SDR */
     int freq;
-    rtlsdr_dev_t *dev;
-    int dev_index;
     int gain;
     int enable_agc;
 } Modes;
@@ -90,26 +544,18 @@ struct {
 void modesInit(void) {
     Modes.data_length = MODES_DATA_LEN;
     Modes.gain = MODES_MAX_GAIN;
-    Modes.dev_index = 0;
+    Modes.inputs = 0;
+    Modes.in = &Modes.input[0];
+    Modes.next_input = 0;
     Modes.freq = MODES_DEFAULT_FREQ;
     Modes.samplerate = MODES_DEFAULT_RATE;
     Modes.filename = NULL;
-    Modes.cumulative_countm = 0;
-    Modes.cumulative_count_a = 0;
-    Modes.cumulative_count_c = 0;
-    Modes.cumulative_count_a_acac = 0;
-    Modes.cumulative_count_c_acac = 0;
-    Modes.cumulative_count_a_acsac = 0;
-    Modes.cumulative_count_c_acsac = 0;
-    Modes.cumulative_count_s = 0;
-    Modes.countm = 0;
-    Modes.count_a = 0;
-    Modes.count_c = 0;
-    Modes.count_a_acac = 0;
-    Modes.count_c_acac = 0;
-    Modes.count_a_acsac = 0;
-    Modes.count_c_acsac = 0;
-    Modes.count_s = 0;
+    Modes.format = FORMAT_CU8;
+    Modes.pair_bytes = 2;
+    Modes.mag_scale = MODES_MAG_SCALE;
+    Modes.scale = 1;
+    Modes.paced = false;
+    Modes.lossless = false;
     Modes.enable_agc = 0;
     Modes.diff = AMP_DIFFERENCE;
     Modes.diffclose = AMP_DIFFERENCE_CLOSE;
@@ -125,43 +571,508 @@ void modesInit(void) {
     Modes.print_detected = false;
     Modes.print_all = false;
     Modes.continuous = false;
-    pthread_mutex_init(&Modes.data_mutex,NULL);
-    pthread_cond_init(&Modes.data_cond,NULL);
-    Modes.data_ready = false;
+    Modes.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (Modes.threads < 1) Modes.threads = 1;
+    for (int j = 0; j < STAGE_COUNT; j++) Modes.affinity[j] = -1;
+    Modes.report_slot = NULL;
+    Modes.report_used = 0;
+    Modes.report_dropping = false;
+    Modes.event_slot = NULL;
+    Modes.event_used = 0;
+    Modes.event_dropping = false;
+    Modes.events_fd = -1;
+    Modes.events_name = NULL;
+    Modes.record_fd = -1;
+    Modes.record_name = NULL;
+    Modes.record_limit = 0;
+    Modes.record_size = 0;
+    Modes.record_seconds = 0;
+    Modes.record_written.store(0, std::memory_order_relaxed);
+    Modes.record_dropped.store(0, std::memory_order_relaxed);
+    Modes.events_format = EVENTS_JSON;
+    Modes.exit = 0;
+    Modes.metrics_fd = -1;
+    Modes.metrics_addr = NULL;
+    Modes.metric_gain.store(MODES_AUTO_GAIN, std::memory_order_relaxed);
+    pthread_mutex_init(&Modes.device_lock, NULL);
+    Modes.control_fd = -1;
+    Modes.control_path = NULL;
+    Modes.control_pending.store(false, std::memory_order_relaxed);
+    Modes.stats_interval = 0;
+    Modes.bl_percentile[0] = 5;
+    Modes.bl_percentile[1] = 50;
+    Modes.bl_percentile[2] = 95;
+    Modes.bl_percentiles = 3;
+    Modes.adaptive = false;
 }
 
-void dataInit(void) {
-    if (Modes.filename != NULL)
-    {
-        off_t size;
-        Modes.fd = open(Modes.filename, O_RDONLY);
-        size = lseek(Modes.fd, 0, SEEK_END);
-        Modes.data_length = size;
+/* Adds an rtl-sdr device, or a file when filename isn't NULL, to the inputs. */
+void addInput(char *filename, int dev_index) {
+    struct input *in;
+    char name[32];
+
+    if (Modes.inputs == MODES_MAX_INPUTS) {
+        fprintf(stderr, "At most %d inputs are supported.\n", MODES_MAX_INPUTS);
+        exit(1);
     }
+    in = &Modes.input[Modes.inputs];
+    in->index = Modes.inputs++;
+    in->filename = filename;
+    in->dev_index = dev_index;
+    in->dev = NULL;
+    in->fd = -1;
+    in->done = false;
+    if (filename != NULL) {
+        in->name = filename;
+    } else {
+        snprintf(name, sizeof(name), "rtl-sdr device %d", dev_index);
+        in->name = strdup(name);
+    }
+    in->capture_start_us = 0;
+    memset(in->tail, 0, sizeof(in->tail));
+    in->thresholds.store(0, std::memory_order_relaxed);
+    in->scan_start = MODES_PATTERN_LEN;
+    in->sample_base = 0;
+    in->reported_drops = 0;
+    memset(&in->adapt, 0, sizeof(in->adapt));
+    memset(&in->traffic, 0, sizeof(in->traffic));
+    in->traffic.run_type = -1;
+    in->cumulative_countm = 0;
+    in->cumulative_count_a = 0;
+    in->cumulative_count_c = 0;
+    in->cumulative_count_a_acac = 0;
+    in->cumulative_count_c_acac = 0;
+    in->cumulative_count_a_acsac = 0;
+    in->cumulative_count_c_acsac = 0;
+    in->cumulative_count_s = 0;
+    in->cumulative_count_s_short = 0;
+    in->cumulative_count_s_long = 0;
+    in->countm = 0;
+    in->count_a = 0;
+    in->count_c = 0;
+    in->count_a_acac = 0;
+    in->count_c_acac = 0;
+    in->count_a_acsac = 0;
+    in->count_c_acsac = 0;
+    in->count_s = 0;
+    in->count_s_short = 0;
+    in->count_s_long = 0;
+}
+
+/* Allocates ring slots. Capacity has to be a power of two. */
+void ringInit(struct blockRing *r, uint32_t capacity, uint32_t block_size) {
+    void *blocks;
 
-    if ((Modes.order = (unsigned char*) malloc(Modes.data_length)) == NULL)
+    if (posix_memalign(&blocks, MODES_CACHE_LINE, (size_t) capacity * block_size) != 0 ||
+        (r->length = (uint32_t *) malloc(capacity * sizeof(uint32_t))) == NULL ||
+        (r->gap = (uint64_t *) calloc(capacity, sizeof(uint64_t))) == NULL)
     {
-        printf("Out of memory allocating data buffer.\n");
+        printf("Out of memory allocating capture ring.\n");
         exit(1);
     }
+    r->blocks = (unsigned char *) blocks;
+    r->block_size = block_size;
+    r->capacity = capacity;
+    r->lost = 0;
+    r->head.store(0, std::memory_order_relaxed);
+    r->tail.store(0, std::memory_order_relaxed);
+    r->enqueued.store(0, std::memory_order_relaxed);
+    r->dropped.store(0, std::memory_order_relaxed);
+    r->consumed.store(0, std::memory_order_relaxed);
+    r->full_stalls.store(0, std::memory_order_relaxed);
+    r->empty_stalls.store(0, std::memory_order_relaxed);
+    r->max_depth.store(0, std::memory_order_relaxed);
+    r->closed.store(false, std::memory_order_relaxed);
+#ifdef MODES_PROFILE
+    r->stamp = (uint64_t *) calloc(capacity, sizeof(uint64_t));
+    r->next_stamp = 0;
+#endif
+}
+
+/* Returns the slot to be filled next or NULL if the ring is full. The slot
+ * becomes visible to the consumer with ringCommit. Producer side only. */
+unsigned char *ringReserve(struct blockRing *r) {
+    uint32_t head = r->head.load(std::memory_order_relaxed);
+    uint32_t tail = r->tail.load(std::memory_order_acquire);
+
+    if (head - tail == r->capacity) return NULL;
+    return r->blocks + (size_t) (head & (r->capacity - 1)) * r->block_size;
+}
+
+/* Publishes the slot returned by ringReserve with len valid bytes. */
+void ringCommit(struct blockRing *r, uint32_t len) {
+    uint32_t head = r->head.load(std::memory_order_relaxed);
+    uint32_t depth = head + 1 - r->tail.load(std::memory_order_relaxed);
+
+    r->length[head & (r->capacity - 1)] = len;
+    r->gap[head & (r->capacity - 1)] = r->lost;
+    r->lost = 0;
+#ifdef MODES_PROFILE
+    r->stamp[head & (r->capacity - 1)] = r->next_stamp;
+#endif
+    r->head.store(head + 1, std::memory_order_release);
+    r->enqueued.fetch_add(1, std::memory_order_relaxed);
+    if (depth > r->max_depth.load(std::memory_order_relaxed)) {
+        r->max_depth.store(depth, std::memory_order_relaxed);
+    }
+}
+
+/* Copies a block to the ring. Never blocks, if the ring is full the block is
+ * counted as dropped, its length is added to the gap of the next committed
+ * slot and false is returned. */
+bool ringPush(struct blockRing *r, const unsigned char *buf, uint32_t len) {
+    unsigned char *slot = ringReserve(r);
+
+    if (slot == NULL) {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        r->lost += len;
+        return false;
+    }
+    if (len > r->block_size) len = r->block_size;
+    memcpy(slot, buf, len);
+    ringCommit(r, len);
+    return true;
+}
+
+/* Returns the oldest unprocessed block or NULL if the ring is empty. The block
+ * stays owned by the consumer until ringRelease is called. Consumer side only. */
+unsigned char *ringPeek(struct blockRing *r, uint32_t *len) {
+    uint32_t tail = r->tail.load(std::memory_order_relaxed);
+    uint32_t head = r->head.load(std::memory_order_acquire);
+
+    if (head == tail) return NULL;
+    uint32_t slot = tail & (r->capacity - 1);
+    *len = r->length[slot];
+    return r->blocks + (size_t) slot * r->block_size;
+}
+
+/* Data dropped between the block returned by ringPeek and the one before it. Consumer side only. */
+static inline uint64_t ringGap(struct blockRing *r) {
+    return r->gap[r->tail.load(std::memory_order_relaxed) & (r->capacity - 1)];
+}
+
+/* Waits until a block is available. Returns NULL once the producer has
+ * closed the ring and every block has been processed. */
+unsigned char *ringWait(struct blockRing *r, uint32_t *len) {
+    unsigned char *block;
+    bool stalled = false;
+
+    while ((block = ringPeek(r, len)) == NULL) {
+        if (r->closed.load(std::memory_order_acquire)) {
+            return ringPeek(r, len);
+        }
+        if (stalled == false) {
+            r->empty_stalls.fetch_add(1, std::memory_order_relaxed);
+            stalled = true;
+        }
+        usleep(MODES_RING_POLL_US);
+    }
+    return block;
+}
+
+/* Waits until a slot can be filled. Used by producers that must not drop data. */
+unsigned char *ringReserveWait(struct blockRing *r) {
+    unsigned char *slot;
+    bool stalled = false;
+
+    while ((slot = ringReserve(r)) == NULL) {
+        if (stalled == false) {
+            r->full_stalls.fetch_add(1, std::memory_order_relaxed);
+            stalled = true;
+        }
+        usleep(MODES_RING_POLL_US);
+    }
+    return slot;
+}
+
+#ifdef MODES_PROFILE
+/* Nanoseconds of a clock that NTP doesn't adjust */
+static inline uint64_t profileNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Capture time of the block returned by ringPeek. Consumer side only. */
+static inline uint64_t ringStamp(struct blockRing *r) {
+    return r->stamp[r->tail.load(std::memory_order_relaxed) & (r->capacity - 1)];
+}
+
+/* Histogram bucket: power of two and the next 3 bits, so buckets are at most 12.5% wide */
+static inline int profileBucket(uint64_t ns) {
+    int msb;
+
+    if (ns < 8) return ns;
+    msb = 63 - __builtin_clzll(ns);
+    return (msb - 2) * 8 + ((ns >> (msb - 3)) & 7);
+}
+
+/* Upper limit of a bucket */
+static inline uint64_t profileBucketLimit(int b) {
+    int msb = b / 8 + 2;
+
+    if (b < 8) return b;
+    return (1ULL << msb) + ((uint64_t) (b % 8 + 1) << (msb - 3)) - 1;
+}
+
+/* Adds a latency, one writer thread per histogram */
+static void profileAdd(struct profileHistogram *h, uint64_t ns) {
+    h->bucket[profileBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    h->count.fetch_add(1, std::memory_order_relaxed);
+    h->sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = h->max.load(std::memory_order_relaxed);
+    while (ns > max && !h->max.compare_exchange_weak(max, ns, std::memory_order_relaxed));
+}
+
+/* Smallest bucket limit that has at least share of the values at or below it,
+ * at most the largest value */
+static uint64_t profilePercentile(struct profileHistogram *h, uint64_t count, double share) {
+    uint64_t max = h->max.load(std::memory_order_relaxed);
+    uint64_t seen = 0;
+
+    for (int b = 0; b < MODES_PROFILE_BUCKETS; b++) {
+        seen += h->bucket[b].load(std::memory_order_relaxed);
+        if (seen >= share * count) return profileBucketLimit(b) < max ? profileBucketLimit(b) : max;
+    }
+    return max;
+}
+
+/* Latency summary of all stages in microseconds. Percentiles are bucket limits. */
+static string profileSummary(void) {
+    static const char *names[PROF_COUNT] = {
+        "Magnitude conversion", "Detection", "Statistics and output hand-off", "Output write",
+        "Capture to magnitude", "Capture to detection", "Capture to output hand-off", "Capture to output written",
+        "Capture to events written"
+    };
+    string out;
+    char line[256];
+
+    snprintf(line, sizeof(line), "Profile, microseconds per block:   %10s %10s %10s %10s %10s %10s\n",
+        "count", "mean", "p50", "p90", "p99", "max");
+    out += line;
+    for (int j = 0; j < PROF_COUNT; j++) {
+        struct profileHistogram *h = &Modes.prof[j];
+        uint64_t count = h->count.load(std::memory_order_relaxed);
+
+        if (count == 0) continue;
+        snprintf(line, sizeof(line), "%-34s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[j],
+            (unsigned long long) count, h->sum.load(std::memory_order_relaxed) / 1e3 / count,
+            profilePercentile(h, count, 0.5) / 1e3, profilePercentile(h, count, 0.9) / 1e3,
+            profilePercentile(h, count, 0.99) / 1e3, h->max.load(std::memory_order_relaxed) / 1e3);
+        out += line;
+    }
+    return out + "\n";
+}
+
+static void profileSignal(int) {
+    Modes.profile_print.store(true, std::memory_order_relaxed);
+}
+#endif
+
+/* Marks the end of the stream for the consumer. */
+void ringClose(struct blockRing *r) {
+    r->closed.store(true, std::memory_order_release);
+}
+
+/* Hands the block returned by ringPeek back to the producer. */
+void ringRelease(struct blockRing *r) {
+    r->tail.store(r->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    r->consumed.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Appends output text to the report ring, which the reporter stage writes out.
+ * Detector stage only. Test files wait for the reporter, but with rtl-sdr the
+ * detector never waits for output: when the ring is full the rest of the
+ * block's text is dropped and counted, so a slow output can't cause lost samples. */
+void reportPrintf(const char *format, ...) {
+    struct blockRing *r = &Modes.report_ring;
+    va_list ap;
+    int n;
+
+    while (1) {
+        if (Modes.report_slot == NULL && Modes.report_dropping == false) {
+            Modes.report_slot = Modes.lossless ? ringReserveWait(r) : ringReserve(r);
+            Modes.report_used = 0;
+            if (Modes.report_slot == NULL) Modes.report_dropping = true;
+        }
+        va_start(ap, format);
+        if (Modes.report_dropping == true) {
+            n = vsnprintf(NULL, 0, format, ap);
+            va_end(ap);
+            r->dropped.fetch_add(n, std::memory_order_relaxed);
+            return;
+        }
+        n = vsnprintf((char *) Modes.report_slot + Modes.report_used, r->block_size - Modes.report_used, format, ap);
+        va_end(ap);
+        if (Modes.report_used + n < r->block_size) {
+            Modes.report_used += n;
+            return;
+        }
+        if (Modes.report_used == 0) {
+            /* Text longer than a slot is cut */
+            Modes.report_used = r->block_size - 1;
+            return;
+        }
+        ringCommit(r, Modes.report_used);
+        Modes.report_slot = NULL;
+    }
+}
+
+/* Hands the text of a block to the reporter. */
+void reportFlush(void) {
+    if (Modes.report_slot != NULL && Modes.report_used > 0) {
+        ringCommit(&Modes.report_ring, Modes.report_used);
+    }
+    Modes.report_slot = NULL;
+    Modes.report_dropping = false;
+}
+
+/* Appends whole event records to the event ring, which the event writer stage
+ * writes out. Detector stage only. Waits or drops like reportPrintf, dropped
+ * counts events. */
+void eventAppend(const void *data, uint32_t len) {
+    struct blockRing *r = &Modes.event_ring;
+
+    if (Modes.event_slot != NULL && Modes.event_used + len > r->block_size) {
+        ringCommit(r, Modes.event_used);
+        Modes.event_slot = NULL;
+    }
+    if (Modes.event_slot == NULL && Modes.event_dropping == false) {
+        Modes.event_slot = Modes.lossless ? ringReserveWait(r) : ringReserve(r);
+        Modes.event_used = 0;
+        if (Modes.event_slot == NULL) Modes.event_dropping = true;
+    }
+    if (Modes.event_dropping == true) {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    memcpy(Modes.event_slot + Modes.event_used, data, len);
+    Modes.event_used += len;
+}
+
+/* Hands the events of a block to the event writer. */
+void eventFlush(void) {
+    if (Modes.event_slot != NULL && Modes.event_used > 0) {
+        ringCommit(&Modes.event_ring, Modes.event_used);
+    }
+    Modes.event_slot = NULL;
+    Modes.event_dropping = false;
+}
+
+/* Pins the calling thread to the CPU given for the stage with --affinity. */
+void setStageAffinity(int stage) {
+    static const char *names[STAGE_COUNT] = { "reader", "magnitude", "detector", "reporter", "events", "record" };
+    cpu_set_t set;
+
+    if (Modes.affinity[stage] < 0) return;
+    CPU_ZERO(&set);
+    CPU_SET(Modes.affinity[stage], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "Could not pin %s stage to CPU %d.\n", names[stage], Modes.affinity[stage]);
+    }
+}
+
+/* Opens recording file number index. Rotated recordings are <path>.0000,
+ * <path>.0001 and so on. Returns -1 after printing the error. */
+int recordOpen(int index) {
+    char name[PATH_MAX + 16];
+    int fd;
+
+    if (Modes.record_limit > 0) snprintf(name, sizeof(name), "%s.%04d", Modes.record_name, index);
+    else snprintf(name, sizeof(name), "%s", Modes.record_name);
+    if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "Error opening %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+/* Test files are streamed through the same ring in windows of data_length
+ * bytes, so memory use doesn't depend on the file size. */
+void dataInit(void) {
+    Modes.mag_block_len = (MODES_PATTERN_LEN + Modes.data_length/Modes.pair_bytes + MODES_CACHE_LINE - 1) & ~(MODES_CACHE_LINE - 1);
+    for (int k = 0; k < Modes.inputs; k++) {
+        struct input *in = &Modes.input[k];
+
+        if (in->filename != NULL)
+        {
+            if (!strcmp(in->filename, "-"))
+            {
+                in->fd = STDIN_FILENO;
+            }
+            else if ((in->fd = open(in->filename, O_RDONLY)) < 0)
+            {
+                fprintf(stderr, "Error opening %s: %s\n", in->filename, strerror(errno));
+                exit(1);
+            }
+            posix_fadvise(in->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
 
-    Modes.order[0] = 0;
+        ringInit(&in->ring, MODES_RING_BLOCKS, Modes.data_length);
+        /* Magnitude slots hold the tail of the previous block and the magnitudes of
+         * a block, then the candidate mask and the thresholds it was made with */
+        ringInit(&in->mag_ring, MODES_RING_BLOCKS, Modes.mag_block_len + Modes.mag_block_len/8 + MODES_CACHE_LINE);
+    }
+    ringInit(&Modes.report_ring, MODES_RING_BLOCKS, MODES_REPORT_CHUNK);
 
-    if ((Modes.data = (unsigned char*) malloc(Modes.data_length/2)) == NULL ||
-    (Modes.magnitude = (uint8_t *) malloc(Modes.data_length)) == NULL)
+    /* Opening a FIFO waits until it has a reader */
+    if (Modes.events_name != NULL)
     {
-        printf("Out of memory allocating data buffer.\n");
-        exit(1);
+        if ((Modes.events_fd = open(Modes.events_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        {
+            fprintf(stderr, "Error opening %s: %s\n", Modes.events_name, strerror(errno));
+            exit(1);
+        }
+        ringInit(&Modes.event_ring, MODES_RING_BLOCKS, MODES_REPORT_CHUNK);
+    }
+
+    if (Modes.record_name != NULL)
+    {
+        if ((Modes.record_fd = recordOpen(0)) < 0) exit(1);
+        ringInit(&Modes.record_ring, MODES_RECORD_BLOCKS, Modes.data_length);
+    }
+}
+
+/* Sets the tuner gain and AGC of the device of an input from Modes.gain and
+ * Modes.enable_agc. Called with device_lock held, at startup and when the
+ * control socket changes them. */
+void setTunerGain(struct input *in) {
+    int gain = Modes.gain;          /* Maximum gain is looked up for each device */
+
+    rtlsdr_set_tuner_gain_mode(in->dev,
+        (gain == MODES_AUTO_GAIN) ? 0 : 1);
+    if (gain != MODES_AUTO_GAIN) {
+        if (gain == MODES_MAX_GAIN) {
+            /* Find the maximum gain available. */
+            int numgains;
+            int gains[100];
+
+            numgains = rtlsdr_get_tuner_gains(in->dev, gains);
+            gain = gains[numgains-1];
+            fprintf(stderr, "Max available gain is: %.2f\n", gain/10.0);
+        }
+        rtlsdr_set_tuner_gain(in->dev, gain);
+        fprintf(stderr, "Setting gain to: %.2f\n", gain/10.0);
+    } else {
+        fprintf(stderr, "Using automatic gain control.\n");
     }
+    rtlsdr_set_agc_mode(in->dev, Modes.enable_agc);
+    Modes.metric_gain.store(rtlsdr_get_tuner_gain(in->dev), std::memory_order_relaxed);
+    fprintf(stderr, "Gain reported by device: %.2f\n",
+        Modes.metric_gain.load(std::memory_order_relaxed)/10.0);
 }
 
-/* RTL-SDR initialization */
-void modesInitRTLSDR(void) {
+/* RTL-SDR initialization of the device of an input. Called from its reader
+ * thread, one device at a time so the messages of several don't mix. */
+void modesInitRTLSDR(struct input *in) {
     int j;
     int device_count;
     int ppm_error = 0;
     char vendor[256], product[256], serial[256];
 
+    pthread_mutex_lock(&Modes.device_lock);
     device_count = rtlsdr_get_device_count();
     if (!device_count) {
         fprintf(stderr, "No supported RTLSDR devices found.\n");
@@ -172,448 +1083,2188 @@ void modesInitRTLSDR(void) {
     for (j = 0; j < device_count; j++) {
         rtlsdr_get_device_usb_strings(j, vendor, product, serial);
         fprintf(stderr, "%d: %s, %s, SN: %s %s\n", j, vendor, product, serial,
-            (j == Modes.dev_index) ? "(currently selected)" : "");
+            (j == in->dev_index) ? "(currently selected)" : "");
     }
 
-    if (rtlsdr_open(&Modes.dev, Modes.dev_index) < 0) {
+    if (rtlsdr_open(&in->dev, in->dev_index) < 0) {
         fprintf(stderr, "Error opening the RTLSDR device: %s\n",
             strerror(errno));
         exit(1);
     }
 
-    /* Set gain, frequency, sample rate, and reset the device. */
-    rtlsdr_set_tuner_gain_mode(Modes.dev,
-        (Modes.gain == MODES_AUTO_GAIN) ? 0 : 1);
-    if (Modes.gain != MODES_AUTO_GAIN) {
-        if (Modes.gain == MODES_MAX_GAIN) {
-            /* Find the maximum gain available. */
-            int numgains;
-            int gains[100];
+    /* Set gain, frequency, sample rate, and reset the device. */
+    rtlsdr_set_freq_correction(in->dev, ppm_error);
+    rtlsdr_set_center_freq(in->dev, Modes.freq);
+    rtlsdr_set_sample_rate(in->dev, Modes.samplerate);
+    rtlsdr_reset_buffer(in->dev);
+    setTunerGain(in);
+    pthread_mutex_unlock(&Modes.device_lock);
+}
+
+
+
+/* Ratio checks of detectMode. Amplitudes are never zero, see populateMagnitudeTable. */
+static inline bool ratioAbove(uint8_t a, uint8_t b, const struct ratioThreshold *t) {
+    return a >= t->above[b];
+}
+
+static inline bool ratioBelow(uint8_t a, uint8_t b, const struct ratioThreshold *t) {
+    return a < t->below[b];
+}
+
+static inline bool ratioAboveInt(uint8_t a, uint8_t b, const struct ratioThreshold *t) {
+    return a >= t->above_int[b];
+}
+
+/* Finds for every denominator the smallest numerator passing each check. */
+void populateRatioTable(struct ratioThreshold *t, float ratio) {
+    int a;
+    int b;
+
+    for (b = 0; b < 256; b++) {
+        t->above[b] = t->below[b] = t->above_int[b] = 256;
+        if (b == 0) continue;
+        for (a = 255; a >= 0; a--) {
+            if ((float) a/b > ratio) t->above[b] = a;
+            if (!((float) a/b < ratio)) t->below[b] = a;
+            if (a/b > ratio) t->above_int[b] = a;
+        }
+    }
+}
+
+/* Compares table form against float division for every 8 bit amplitude pair. */
+bool verifyRatioTable(const struct ratioThreshold *t, float ratio) {
+    int a;
+    int b;
+
+    for (b = 1; b < 256; b++) {
+        for (a = 0; a < 256; a++) {
+            if (ratioAbove(a, b, t) != ((float) a/b > ratio) ||
+                ratioBelow(a, b, t) != ((float) a/b < ratio) ||
+                ratioAboveInt(a, b, t) != (a/b > ratio))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Turns ratio parameters to integer thresholds so detection has no divisions. */
+void populateRatioTables(void) {
+    struct { struct ratioThreshold *t; float ratio; const char *name; } ratios[] = {
+        { &Modes.thr_diffratio, Modes.diffratio, "diffratio" },
+        { &Modes.thr_diffratioclose, Modes.diffratioclose, "diffratioclose" },
+        { &Modes.thr_diffratiop4, Modes.diffratiop4, "diffratiop4" },
+        { &Modes.thr_diffratioclosep4, Modes.diffratioclosep4, "diffratioclosep4" },
+    };
+
+    for (auto &r : ratios) {
+        populateRatioTable(r.t, r.ratio);
+        if (!verifyRatioTable(r.t, r.ratio)) {
+            fprintf(stderr, "Integer form of %s %f doesn't match float division.\n", r.name, r.ratio);
+            exit(1);
+        }
+    }
+}
+
+/* Packs the thresholds of the candidate kernels to one word, so the detector can
+ * hand them to the magnitude stages atomically. */
+static inline uint32_t packThresholds(int diff, int mpa, int mnf, int mnfc) {
+    return (uint32_t) diff | (uint32_t) mpa << 8 | (uint32_t) mnf << 16 | (uint32_t) mnfc << 24;
+}
+
+static inline uint32_t currentThresholds(void) {
+    return packThresholds(Modes.diff, Modes.min_peak_amp, Modes.max_noicefloor, Modes.max_noicefloor_close);
+}
+
+/* True if candidate bits made with thresholds used have every position that
+ * current ones would have. Extra positions only cost a full check in detectAt. */
+static inline bool thresholdsCover(uint32_t used, uint32_t current) {
+    return (used & 0xff) <= (current & 0xff) && (used >> 8 & 0xff) <= (current >> 8 & 0xff) &&
+        (used >> 16 & 0xff) >= (current >> 16 & 0xff) && (used >> 24) >= (current >> 24);
+}
+
+/* Candidate mask and the thresholds it was made with, after the magnitudes of a magnitude slot */
+static inline uint64_t *slotCandidates(unsigned char *slot) {
+    return (uint64_t *) (slot + Modes.mag_block_len);
+}
+
+static inline uint32_t *slotThresholds(unsigned char *slot) {
+    return (uint32_t *) (slot + Modes.mag_block_len + Modes.mag_block_len/8);
+}
+
+/* Returns the first P1 candidate at or after position i, or end if there is none. */
+static inline int nextCandidate(const uint64_t *mask, int i, int end) {
+    int w = i >> 6;
+    uint64_t bits = mask[w] & (~0ULL << (i & 63));
+
+    while (bits == 0) {
+        if (++w << 6 >= end) return end;
+        bits = mask[w];
+    }
+    return (w << 6) + __builtin_ctzll(bits);
+}
+
+/* Sample offsets from P1 at a sample rate, compile time constants for the checks below */
+template<int Rate>
+struct pulseOffsets {
+    static constexpr struct sampleTiming t = timingAt(Rate);
+    static constexpr int w = t.w;
+    static constexpr int lw = t.lw;
+    static constexpr int p1b = t.w - 1;             /* Last P1 sample */
+    static constexpr int n1c = t.w;                 /* Non pulse right after P1 */
+    static constexpr int n1 = t.w + 1;              /* Non pulse after P1 */
+    static constexpr int n2c = t.p2 - 1;            /* Non pulse right before Mode S P2 */
+    static constexpr int p2 = t.p2;                 /* Mode S P2 */
+    static constexpr int p2b = t.p2 + t.w - 1;
+    static constexpr int n3c = t.p2 + t.w;          /* Non pulse right after P2 */
+    static constexpr int n3 = t.p2 + t.w + 1;
+    static constexpr int a3 = t.p3a;                /* Mode A P3 */
+    static constexpr int a3b = t.p3a + t.w - 1;
+    static constexpr int c3 = t.p3c;                /* Mode C P3 */
+    static constexpr int c3b = t.p3c + t.w - 1;
+};
+
+/* Checks of detectAt, one per part of the patterns. Separate functions so each
+* part can be benchmarked and compared against the original code on its own,
+* see kernelbench.cpp. */
+
+/* P1 pulse and non pulse values that exist in all Mode A/C/S messages */
+template<int Rate>
+static inline bool checkP1(const uint8_t *m, int i) {
+    typedef pulseOffsets<Rate> O;
+
+    return !(ratioAbove(m[i+O::n1c], m[i], &Modes.thr_diffratioclose) || ratioAbove(m[i+O::n1c], m[i+O::p1b], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::n1], m[i], &Modes.thr_diffratio) || ratioAbove(m[i+O::n1], m[i+O::p1b], &Modes.thr_diffratio) ||
+        m[i]<=m[i+O::n1c]+Modes.diff || m[i+O::p1b]<=m[i+O::n1c]+Modes.diff ||
+        m[i]<=m[i+O::n1]+Modes.diff || m[i+O::p1b]<=m[i+O::n1]+Modes.diff ||
+        m[i]<=m[i+O::n2c]+Modes.diff || m[i+O::p1b]<=m[i+O::n2c]+Modes.diff ||
+        m[i]<=m[i+O::n3c]+Modes.diff || m[i+O::p1b]<=m[i+O::n3c]+Modes.diff ||
+        m[i]<=Modes.min_peak_amp || m[i+O::p1b]<=Modes.min_peak_amp ||
+        m[i+O::n1c]>=Modes.max_noicefloor_close || m[i+O::n1]>=Modes.max_noicefloor);
+}
+
+/* Valid Mode S preample. If there is P2 pulse 2 microseconds after start the
+* message is Mode S message. */
+template<int Rate>
+static inline bool checkModeS(const uint8_t *m, int i) {
+    typedef pulseOffsets<Rate> O;
+
+    return m[i+O::p2] >= m[i+O::n1]+Modes.diff &&
+        m[i+O::p2b] >= m[i+O::n1]+Modes.diff &&
+        m[i+O::p2] >= m[i+O::n2c]+Modes.diffclose &&
+        m[i+O::p2b] >= m[i+O::n2c]+Modes.diffclose &&
+        m[i+O::p2] >= m[i+O::n1c]+Modes.diffclose &&
+        m[i+O::p2b] >= m[i+O::n1c]+Modes.diffclose &&
+        m[i+O::p2] >= m[i+O::n3c]+Modes.diffclose &&
+        m[i+O::p2b] >= m[i+O::n3c]+Modes.diffclose &&
+        m[i+O::p2] >= m[i+O::n3]+Modes.diffclose &&
+        m[i+O::p2b] >= m[i+O::n3]+Modes.diffclose &&
+        m[i+O::p2] >= Modes.min_peak_amp &&
+        m[i+O::p2b] >= Modes.min_peak_amp &&
+        m[i+O::n1c] <= Modes.max_noicefloor_close &&
+        m[i+O::n1] <= Modes.max_noicefloor &&
+        m[i+O::n2c] <= Modes.max_noicefloor_close &&
+        m[i+O::n3c] <= Modes.max_noicefloor_close &&
+        m[i+O::n3] <= Modes.max_noicefloor_close &&
+        ratioBelow(m[i+O::n2c], m[i], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n2c], m[i+O::p1b], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n3c], m[i], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n3c], m[i+O::p1b], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n1], m[i+O::p2], &Modes.thr_diffratio) &&
+        ratioBelow(m[i+O::n1], m[i+O::p2b], &Modes.thr_diffratio) &&
+        ratioBelow(m[i+O::n2c], m[i+O::p2], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n2c], m[i+O::p2b], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n1c], m[i+O::p2], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n1c], m[i+O::p2b], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n3c], m[i+O::p2], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n3c], m[i+O::p2b], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n3], m[i+O::p2], &Modes.thr_diffratioclose) &&
+        ratioBelow(m[i+O::n3], m[i+O::p2b], &Modes.thr_diffratioclose);
+}
+
+/* Mode A message has 8 microseconds between start of P1 and start of P3. */
+template<int Rate>
+static inline bool checkModeA(const uint8_t *m, int i) {
+    typedef pulseOffsets<Rate> O;
+    int a;
+
+    if (m[i+O::a3]<Modes.min_peak_amp || m[i+O::a3b]<Modes.min_peak_amp) { return false; }
+    for (a = O::n1; a < O::a3 - 1; a++)
+    {
+        if (m[i+a]+Modes.diff>=m[i+O::a3] || ratioAbove(m[i+a], m[i+O::a3], &Modes.thr_diffratio)) { return false; }
+        if (m[i+a]+Modes.diff>=m[i+O::a3b] || ratioAbove(m[i+a], m[i+O::a3b], &Modes.thr_diffratio)) { return false; }
+        if (m[i+a]>Modes.max_noicefloor) { return false; }
+    }
+    return !(m[i+O::a3+O::w]+Modes.diffclose>=m[i+O::a3]   || m[i+O::a3+O::w]+Modes.diffclose>=m[i+O::a3b] ||
+        m[i+O::a3+O::w+1]+Modes.diff>=m[i+O::a3]      || m[i+O::a3+O::w+1]+Modes.diff>=m[i+O::a3b]    ||
+        m[i+O::a3+O::w+2]+Modes.diffclose>=m[i+O::a3] || m[i+O::a3+O::w+2]+Modes.diffclose>=m[i+O::a3b] ||
+        m[i+O::a3-1]+Modes.diffclose>=m[i+O::a3]     || m[i+O::a3-1]+Modes.diffclose>=m[i+O::a3b]   ||
+        m[i+O::n1c]+Modes.diffclose>=m[i+O::a3]      || m[i+O::n1c]+Modes.diffclose>=m[i+O::a3b]    ||
+        m[i+O::a3+O::w]>Modes.max_noicefloor_close ||
+        m[i+O::a3+O::w+1]>Modes.max_noicefloor     ||
+        m[i+O::a3+O::w+2]>Modes.max_noicefloor     ||
+        m[i+O::a3-1]>Modes.max_noicefloor_close   ||
+        m[i+O::a3]<Modes.min_peak_amp             ||
+        m[i+O::a3b]<Modes.min_peak_amp            ||
+        ratioAbove(m[i+O::n1c], m[i+O::a3], &Modes.thr_diffratioclose)     ||
+        ratioAbove(m[i+O::n1c], m[i+O::a3b], &Modes.thr_diffratioclose)    ||
+        ratioAbove(m[i+O::a3+O::w], m[i+O::a3], &Modes.thr_diffratioclose)  ||
+        ratioAbove(m[i+O::a3+O::w], m[i+O::a3b], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::a3+O::w+1], m[i+O::a3], &Modes.thr_diffratio)     ||
+        ratioAbove(m[i+O::a3+O::w+1], m[i+O::a3b], &Modes.thr_diffratio));
+}
+
+/* Mode C message has 21 microseconds between start of P1 and start of P3. */
+template<int Rate>
+static inline bool checkModeC(const uint8_t *m, int i) {
+    typedef pulseOffsets<Rate> O;
+    int c;
+
+    for (c = O::n1; c < O::c3 - 1; c++) {
+        if (m[i+c]+Modes.diff>m[i+O::c3] || ratioAboveInt(m[i+c], m[i+O::c3], &Modes.thr_diffratio)) { return false; }
+        if (m[i+c]+Modes.diff>m[i+O::c3b] || ratioAboveInt(m[i+c], m[i+O::c3b], &Modes.thr_diffratio)) { return false; }
+        if (m[i+c]>Modes.max_noicefloor) { return false; }
+    }
+    return !(m[i+O::c3+O::w]+Modes.diffclose>=m[i+O::c3] || m[i+O::c3+O::w]+Modes.diffclose>=m[i+O::c3b] ||
+        m[i+O::c3+O::w+1]+Modes.diff>=m[i+O::c3]      || m[i+O::c3+O::w+1]+Modes.diff>=m[i+O::c3b]    ||
+        m[i+O::c3+O::w+2]+Modes.diffclose>=m[i+O::c3] || m[i+O::c3+O::w+2]+Modes.diffclose>=m[i+O::c3b] ||
+        m[i+O::n1c]+Modes.diffclose>=m[i+O::c3]      || m[i+O::c3-1]+Modes.diffclose>=m[i+O::c3b]   ||
+        m[i+O::c3+O::w]>Modes.max_noicefloor_close ||
+        m[i+O::c3+O::w+1]>Modes.max_noicefloor     ||
+        m[i+O::c3+O::w+2]>Modes.max_noicefloor     ||
+        m[i+O::c3-1]>Modes.max_noicefloor_close   ||
+        m[i+O::c3]<Modes.min_peak_amp             ||
+        m[i+O::c3b]<Modes.min_peak_amp            ||
+        ratioAbove(m[i+O::n1c], m[i+O::c3], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::n1c], m[i+O::c3b], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::c3-1], m[i+O::c3], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::c3-1], m[i+O::c3b], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::c3+O::w], m[i+O::c3], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::c3+O::w], m[i+O::c3b], &Modes.thr_diffratioclose) ||
+        ratioAbove(m[i+O::c3+O::w+1], m[i+O::c3], &Modes.thr_diffratio) ||
+        ratioAbove(m[i+O::c3+O::w+1], m[i+O::c3b], &Modes.thr_diffratio));
+}
+
+/* Short P4 pulse os samples after P1, p3 is the offset of P3. Non pulse values
+* between P3 and P4 are g1 after P3, g3 before P4 and g2 between them. */
+template<int Rate>
+static inline bool checkShortP4(const uint8_t *m, int i, int p3, int os) {
+    typedef pulseOffsets<Rate> O;
+    int g1 = p3 + O::w;
+    int g2 = os - 2;
+    int g3 = os - 1;
+
+    return ratioBelow(m[i+g3], m[i+os], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+g3], m[i+os+O::w-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+g2], m[i+os], &Modes.thr_diffratiop4)      && ratioBelow(m[i+g2], m[i+os+O::w-1], &Modes.thr_diffratiop4)
+        && ratioBelow(m[i+g1], m[i+os], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+g1], m[i+os+O::w-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+os+O::w], m[i+os], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+os+O::w], m[i+os+O::w-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+os+O::w+1], m[i+os], &Modes.thr_diffratiop4) && ratioBelow(m[i+os+O::w+1], m[i+os+O::w-1], &Modes.thr_diffratiop4)
+        && m[i+os] > Modes.min_peak_amp && m[i+os+O::w-1] > Modes.min_peak_amp
+        && m[i+os+O::w] < Modes.max_noicefloor_close && m[i+g3] < Modes.max_noicefloor_close
+        && m[i+g2] < Modes.max_noicefloor && m[i+g1] < Modes.max_noicefloor_close;
+}
+
+/* Long P4 pulse, checked from its first, last and two middle samples */
+template<int Rate>
+static inline bool checkLongP4(const uint8_t *m, int i, int p3, int os) {
+    typedef pulseOffsets<Rate> O;
+    int g1 = p3 + O::w;
+    int g2 = os - 2;
+    int g3 = os - 1;
+
+    return ratioBelow(m[i+g3], m[i+os], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+g3], m[i+os+O::w-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+g3], m[i+os+O::lw-O::w], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+g3], m[i+os+O::lw-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+g2], m[i+os], &Modes.thr_diffratiop4) && ratioBelow(m[i+g2], m[i+os+O::w-1], &Modes.thr_diffratiop4)
+        && ratioBelow(m[i+g2], m[i+os+O::lw-O::w], &Modes.thr_diffratiop4) && ratioBelow(m[i+g2], m[i+os+O::lw-1], &Modes.thr_diffratiop4)
+        && ratioBelow(m[i+g1], m[i+os], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+g1], m[i+os+O::w-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+g1], m[i+os+O::lw-O::w], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+g1], m[i+os+O::lw-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+os+O::lw], m[i+os], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+os+O::lw], m[i+os+O::w-1], &Modes.thr_diffratioclosep4)
+        && ratioBelow(m[i+os+O::lw], m[i+os+O::lw-O::w], &Modes.thr_diffratioclosep4) && ratioBelow(m[i+os+O::lw], m[i+os+O::lw-1], &Modes.thr_diffratioclosep4)
+        && m[i+os] > Modes.min_peak_amp && m[i+os+O::w-1] > Modes.min_peak_amp && m[i+os+O::lw-O::w] > Modes.min_peak_amp && m[i+os+O::lw-1] > Modes.min_peak_amp
+        && m[i+g3] < Modes.max_noicefloor_close && m[i+os+O::lw] < Modes.max_noicefloor_close && m[i+g1] < Modes.max_noicefloor_close
+        && m[i+g2] < Modes.max_noicefloor;
+}
+
+/* Length of Mode S P6 from its envelope. The phase reversals of the data leave
+* dips in the magnitude that can last microseconds, so instead of following the
+* trailing edge the mean magnitude where only long P6 lasts is compared with the
+* mean where both lengths do. P6 is there if the latter is a quarter of P2.
+* Returns the offset from P1 of the end of P6, where scanning continues, or of
+* the start of P6 when there is none, see p6Class. */
+template<int Rate>
+static inline int measureP6(const uint8_t *m, int i) {
+    typedef pulseOffsets<Rate> O;
+    constexpr int both = O::t.p6_short - O::t.p6 - 2*O::t.edge;             /* Samples in each window */
+    constexpr int late = O::t.p6_long - O::t.p6_short - 2*O::t.edge;
+    int peak = m[i+O::p2] > m[i+O::p2b] ? m[i+O::p2] : m[i+O::p2b];
+    int sum_both = 0;
+    int sum_late = 0;
+    int k;
+
+    for (k = O::t.p6 + O::t.edge; k < O::t.p6_short - O::t.edge; k++) sum_both += m[i+k];
+    if (sum_both * 4 < peak * both) return O::t.p6;
+    for (k = O::t.p6_short + O::t.edge; k < O::t.p6_long - O::t.edge; k++) sum_late += m[i+k];
+    return sum_late * 2 * both >= sum_both * late ? O::t.p6_long : O::t.p6_short;
+}
+
+/* Checks if a message starts from position i of magnitude vector data.
+* Checks first simpler and smaller patterns before moving to longer checks.
+* Returns the order number of the detected message type or 0, and sets next to the
+* position where scanning continues. Only reads the data so segments of a block can
+* be checked in parallel. Instantiated for every supported sample rate so all pulse
+* offsets are compile time constants. */
+template<int Rate>
+static int detectAt(const uint8_t *m, int i, int *next) {
+    typedef pulseOffsets<Rate> O;
+    int type;
+    int os; /* offset of P4 that depends on if it is Mode A or C message.  */
+    int p3; /* offset of P3 */
+
+    *next = i + 1;
+    if (!checkP1<Rate>(m, i)) return 0;
+
+    if (checkModeS<Rate>(m, i)) {
+        *next = i + measureP6<Rate>(m, i);
+        return 3;
+    }
+
+    if (checkModeA<Rate>(m, i)) {
+        type = 1;
+        p3 = O::a3;
+        os = O::t.p4a;
+    } else if (checkModeC<Rate>(m, i)) {
+        type = 2;
+        p3 = O::c3;
+        os = O::t.p4c;
+    } else {
+        return 0;
+    }
+
+    if (checkShortP4<Rate>(m, i, p3, os)) {
+        *next = i + os + O::w + 1;
+        return 20 + type; /* 20 --> short p4 */
+    }
+    if (checkLongP4<Rate>(m, i, p3, os)) {
+        *next = i + os + O::lw + 1;
+        return 30 + type; /* 30 --> long p4 (compatibility mode) */
+    }
+
+    /* No p4 pulse. Mode A continues one sample before P4 position, Mode C from it */
+    *next = (type == 1) ? i + os - 1 : i + os;
+    return 10 + type; /* 10 --> no p4 */
+}
+
+/* Prints location and amplitude values of a detected message */
+static void printMessage(const char *format, const uint8_t *m, int i, int len) {
+    int a;
+
+    reportPrintf(format, (unsigned long long) (Modes.in->sample_base + i - MODES_PATTERN_LEN));
+    for(a = 0; a < len; a++) {
+        reportPrintf(" %d", m[i+a]);
+    }
+    reportPrintf("\n\n");
+}
+
+/* Highest sample of a pulse of w samples */
+static inline uint8_t pulsePeak(const uint8_t *m, int w) {
+    uint8_t peak = m[0];
+
+    for (int a = 1; a < w; a++) {
+        if (m[a] > peak) peak = m[a];
+    }
+    return peak;
+}
+
+/* Message type names of the event output */
+static const char *eventName(int code) {
+    switch (code) {
+    case 3: return "mode_s";
+    case 11: return "mode_a";
+    case 12: return "mode_c";
+    case 21: return "mode_a_all_call";
+    case 22: return "mode_c_all_call";
+    case 31: return "mode_a_all_call_compat";
+    case 32: return "mode_c_all_call_compat";
+    }
+    return "unknown";
+}
+
+/* Writes the event record of a detected message. */
+static void writeEvent(const uint8_t *m, int i, int code) {
+    const struct sampleTiming *t = &Modes.timing;
+    struct eventRecord e;
+    int p3 = code == 3 ? t->p2 : code % 10 == 1 ? t->p3a : t->p3c;
+    int p4 = p3 + (t->p4a - t->p3a);
+    int sum = 0;
+    int a;
+
+    memset(&e, 0, sizeof(e));
+    e.sample = Modes.in->sample_base + i - MODES_PATTERN_LEN;
+    e.time_us = Modes.in->capture_start_us + (int64_t) (e.sample * 1000000 / Modes.samplerate);
+    e.code = code;
+    e.input = Modes.in->index;
+    e.p1 = pulsePeak(m + i, t->w);
+    e.p3 = pulsePeak(m + i + p3, t->w);
+    if (code / 10 == 2) e.p4 = pulsePeak(m + i + p4, t->w);
+    if (code / 10 == 3) e.p4 = pulsePeak(m + i + p4, t->lw);
+    for (a = t->w; a < p3; a++) sum += m[i+a];
+    e.noise = sum / (p3 - t->w);
+
+    if (Modes.events_format == EVENTS_BINARY) {
+        eventAppend(&e, sizeof(e));
+    } else {
+        char line[256];
+        int n = snprintf(line, sizeof(line),
+            "{\"type\":\"%s\",\"code\":%d,\"sample\":%llu,\"time\":%lld.%06lld,\"p1\":%d,\"p3\":%d,\"p4\":%d,\"noise\":%d",
+            eventName(code), code, (unsigned long long) e.sample, (long long) (e.time_us / 1000000),
+            (long long) (e.time_us % 1000000), e.p1, e.p3, e.p4, e.noise);
+
+        if (Modes.inputs > 1) n += snprintf(line + n, sizeof(line) - n, ",\"input\":%d", e.input);
+        n += snprintf(line + n, sizeof(line) - n, "}\n");
+        eventAppend(line, n);
+    }
+}
+
+/* Uplink length of a Mode S message, from where measureP6 continued scanning */
+enum { P6_NONE, P6_SHORT, P6_LONG };
+
+static inline int p6Class(int length) {
+    const struct sampleTiming *t = &Modes.timing;
+
+    if (length <= t->p6) return P6_NONE;
+    return length < t->p6_long ? P6_SHORT : P6_LONG;
+}
+
+/* Statistics index of a message type order number, in the order of printStats */
+static int messageIndex(int code) {
+    switch (code) {
+    case 11: return 0;
+    case 12: return 1;
+    case 21: return 2;
+    case 22: return 3;
+    case 31: return 4;
+    case 32: return 5;
+    case 3: return 6;
+    }
+    return -1;
+}
+
+/* Power of two bucket of a value, 0 and 1 go to the first bucket */
+static inline int logBucket(uint64_t v) {
+    int b = v > 1 ? 63 - __builtin_clzll(v) : 0;
+
+    return b < MODES_LOG_BUCKETS ? b : MODES_LOG_BUCKETS - 1;
+}
+
+/* Moves the rate window to the given second, clearing the seconds in between. */
+static void statsAdvance(uint64_t second) {
+    struct trafficStats *st = &Modes.in->traffic;
+    uint64_t s;
+
+    if (second <= st->second) return;
+    for (s = st->second + 1; s <= second && s <= st->second + MODES_RATE_SECONDS; s++) {
+        memset(st->window[s & (MODES_RATE_SECONDS - 1)], 0, sizeof(st->window[0]));
+    }
+    st->second = second;
+}
+
+/* Adds a run of length messages of type t to the run statistics. */
+static void statsRun(int t, uint64_t length) {
+    struct trafficStats *st = &Modes.in->traffic;
+
+    st->runs[t][logBucket(length)]++;
+    st->run_total[t] += length;
+    st->run_count[t]++;
+    if (length > st->run_max[t]) st->run_max[t] = length;
+}
+
+/* Adds the time since the previous message of statistics index k. Sample indexes
+ * are stored plus one so 0 means no message yet. */
+static inline void statsGap(int k, uint64_t sample) {
+    struct trafficStats *st = &Modes.in->traffic;
+
+    if (st->last[k] != 0) st->interarrival[k][logBucket((sample + 1 - st->last[k]) * 1000000 / Modes.samplerate)]++;
+    st->last[k] = sample + 1;
+}
+
+/* Adds a detected message to the traffic statistics. */
+static void statsRecord(uint64_t sample, int code) {
+    struct trafficStats *st = &Modes.in->traffic;
+    uint64_t second = sample / Modes.samplerate;
+    int t = messageIndex(code);
+
+    if (t < 0) return;
+    statsAdvance(second);
+    st->window[second & (MODES_RATE_SECONDS - 1)][t]++;
+    st->window[second & (MODES_RATE_SECONDS - 1)][MODES_MESSAGE_TYPES]++;
+    statsGap(t, sample);
+    statsGap(MODES_MESSAGE_TYPES, sample);
+    if (t == st->run_type) {
+        st->run_length++;
+    } else {
+        if (st->run_type >= 0) statsRun(st->run_type, st->run_length);
+        st->run_type = t;
+        st->run_length = 1;
+    }
+}
+
+static inline void orderAdd(uint64_t sample, int code) {
+    struct orderLog *log = &Modes.order;
+    struct orderRun *r;
+
+    if (log->runs > 0 && log->run[log->runs-1].code == code) {
+        r = &log->run[log->runs-1];
+        r->count++;
+        r->last = sample;
+    } else if (log->runs < MODES_ORDER_RUNS) {
+        r = &log->run[log->runs++];
+        r->first = sample;
+        r->last = sample;
+        r->count = 1;
+        r->code = code;
+    } else {
+        log->lost++;
+    }
+}
+
+static inline void baselineAdd(int category, uint8_t v) {
+    struct baselineHistogram *h = &Modes.baseline[category];
+
+    h->bin[v]++;
+    h->count++;
+    h->sum += v;
+    if (category == BASELINE_PULSE && Modes.adaptive == true) {
+        Modes.in->adapt.pending[v]++;
+        Modes.in->adapt.pending_count++;
+    }
+}
+
+/* Counts a detected message, adds it to the order of messages and collects
+* baseline values of accepted messages, also used by the adaptive thresholds.
+* next is where detectAt continued scanning. */
+void recordMessage(const uint8_t *m, int i, int code, int next) {
+    const struct sampleTiming *t = &Modes.timing;
+    int a;
+    int c;
+
+    Modes.in->countm++;
+    if (Modes.print_order == true) orderAdd(Modes.in->sample_base + i - MODES_PATTERN_LEN, code);
+    if (Modes.events_fd >= 0) writeEvent(m, i, code);
+    if (Modes.stats_interval > 0) statsRecord(Modes.in->sample_base + i - MODES_PATTERN_LEN, code);
+    switch (code) {
+    case 3:
+        Modes.in->count_s++;
+        switch (p6Class(next - i)) {
+        case P6_SHORT: Modes.in->count_s_short++; break;
+        case P6_LONG: Modes.in->count_s_long++; break;
+        }
+        if (Modes.baselinemode == true || Modes.adaptive == true)
+        {
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->p2-1]);
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->w]);
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->p2+t->w]);
+            baselineAdd(BASELINE_NF, m[i+t->w+1]);
+            baselineAdd(BASELINE_PULSE, m[i+t->p2]);
+            baselineAdd(BASELINE_PULSE, m[i+t->p2+t->w-1]);
+            baselineAdd(BASELINE_PULSE, m[i+t->w-1]);
+            baselineAdd(BASELINE_PULSE, m[i]);
+        }
+        if (Modes.print_detected == true) printMessage("Mode S message in starting from bit number: %llu ", m, i, t->p2+t->w+2);
+        break;
+    case 21:
+        Modes.in->count_a_acac++;
+        if (Modes.print_detected == true) printMessage("Mode A all-call Message in location: %llu: ", m, i, t->len_a);
+        break;
+    case 22:
+        Modes.in->count_c_acac++;
+        if (Modes.print_detected == true) printMessage("Mode C all-call Message in location: %llu: ", m, i, t->len_c);
+        break;
+    case 31:
+        Modes.in->count_a_acsac++;
+        if (Modes.print_detected == true) printMessage("Mode A all-call (Compatibility mode) Message starting from bit number: %llu ", m, i, t->len_a);
+        break;
+    case 32:
+        Modes.in->count_c_acsac++;
+        if (Modes.print_detected == true) printMessage("Mode C all-call (Compatibility mode) Message starting from bit number: %llu ", m, i, t->len_c);
+        break;
+    case 11:
+        Modes.in->count_a++;
+        if (Modes.baselinemode == true || Modes.adaptive == true)
+        {
+            for (a = t->w+1; a < t->p3a-1; a++) {
+                baselineAdd(BASELINE_NF, m[i+a]);
+            }
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->p3a-1]);
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->w]);
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->p3a+t->w]);
+            baselineAdd(BASELINE_NF, m[i+t->p3a+t->w+1]);
+            baselineAdd(BASELINE_PULSE, m[i]);
+            baselineAdd(BASELINE_PULSE, m[i+t->w-1]);
+            baselineAdd(BASELINE_PULSE, m[i+t->p3a]);
+            baselineAdd(BASELINE_PULSE, m[i+t->p3a+t->w-1]);
+        }
+        if (Modes.print_detected == true) printMessage("Mode A Message starting from bit number: %llu ", m, i, t->len_a);
+        break;
+    case 12:
+        Modes.in->count_c++;
+        if (Modes.baselinemode == true || Modes.adaptive == true)
+        {
+            for (c = t->w+1; c < t->p3c-1; c++) {
+                baselineAdd(BASELINE_NF, m[i+c]);
+            }
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->p3c-1]);
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->w]);
+            baselineAdd(BASELINE_NFCLOSE, m[i+t->p3c+t->w]);
+            baselineAdd(BASELINE_PULSE, m[i+t->p3c]);
+            baselineAdd(BASELINE_PULSE, m[i+t->p3c+t->w-1]);
+            baselineAdd(BASELINE_PULSE, m[i]);
+            baselineAdd(BASELINE_PULSE, m[i+t->w-1]);
+        }
+        if (Modes.print_detected == true) printMessage("Mode C Message starting from bit number: %llu ", m, i, t->len_c);
+        break;
+    }
+}
+
+/* Scans positions from i to end. Detected messages are appended to hits, or
+* recorded right away when hits is NULL. Returns the position after the last
+* scanned one. */
+template<int Rate>
+static int scanRange(const uint8_t *m, int i, int end, vector<struct detection> *hits) {
+    int next;
+    int code;
+
+    while (i < end) {
+        if (Modes.print_all == true)
+        {
+            reportPrintf(" %d", m[i]);
+        }
+        else if ((i = nextCandidate(Modes.candidates, i, end)) == end)
+        {
+            break;
+        }
+        if ((code = detectAt<Rate>(m, i, &next)) != 0)
+        {
+            if (hits == NULL) recordMessage(m, i, code, next);
+            else hits->push_back({i, next, code});
+        }
+        i = next;
+    }
+    return i;
+}
+/* Scans one segment of the block in a worker. Stale candidate bits are computed from
+* the segment start which is a multiple of 64, so workers write separate mask words. */
+static void scanSegment(int k) {
+    struct detectorPool *pool = &Modes.pool;
+    int from = k * pool->seglen;
+    int to = from + pool->seglen < pool->end ? from + pool->seglen : pool->end;
+
+    if (Modes.candidates_stale) {
+        Modes.candidate_kernel(pool->m + from, to - from, Modes.candidates + from/64, currentThresholds());
+    }
+    pool->hits[k].clear();
+    pool->exit[k] = Modes.scan_range(pool->m, k == 0 ? pool->start : from, to, &pool->hits[k]);
+}
+
+void *detectorWorker(void *arg) {
+    struct detectorPool *pool = &Modes.pool;
+    int k = (int) (intptr_t) arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (pool->generation == seen) {
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+        }
+        seen = pool->generation;
+        if (k >= pool->segments) continue;
+        pthread_mutex_unlock(&pool->mutex);
+
+        scanSegment(k);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done_cond);
+    }
+    return NULL;
+}
+
+/* Starts worker threads, the detector thread itself scans the first segment. */
+void detectorPoolInit(void) {
+    struct detectorPool *pool = &Modes.pool;
+    int k;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pool->generation = 0;
+    pool->hits = new vector<struct detection>[Modes.threads];
+    pool->exit = new int[Modes.threads];
+    pool->threads = new pthread_t[Modes.threads];
+    for (k = 1; k < Modes.threads; k++) {
+        pthread_create(&pool->threads[k], NULL, detectorWorker, (void *) (intptr_t) k);
+    }
+}
+
+/* Records the hits of segments in order. Scanning of the block was split into segments
+* that were all started from their first position, but sequential scanning can enter a
+* segment later because of a skip after a message near the end of the previous one.
+* If that position lies in a range the segment's scan skipped, scanning is repeated
+* here sequentially until it reaches a position the segment's scan also visited. From
+* there on both scans are the same, so the result equals a single threaded scan. */
+static int mergeSegments(void) {
+    struct detectorPool *pool = &Modes.pool;
+    const uint8_t *m = pool->m;
+    int p = pool->start;
+    int k;
+
+    for (k = 0; k < pool->segments; k++) {
+        vector<struct detection> &hits = pool->hits[k];
+        int to = (k + 1) * pool->seglen < pool->end ? (k + 1) * pool->seglen : pool->end;
+        size_t j = 0;
+        bool synced = false;
+
+        while (p < to) {
+            int next;
+            int code;
+            int c;
+
+            while (j < hits.size() && hits[j].pos < p) j++;
+            if (j == 0 || hits[j-1].next <= p) { synced = true; break; }
+
+            /* Segment skipped past p, positions before the first candidate are the same for both */
+            if ((c = nextCandidate(Modes.candidates, p, to)) >= hits[j-1].next) {
+                p = hits[j-1].next;
+                continue;
+            }
+            if ((code = Modes.detect_at(m, c, &next)) != 0) recordMessage(m, c, code, next);
+            p = next;
+        }
+        if (synced) {
+            for (; j < hits.size(); j++) recordMessage(m, hits[j].pos, hits[j].code, hits[j].next);
+            p = pool->exit[k];
+        }
+    }
+    return p;
+}
+
+/* Scans the block in segments in parallel and merges the results in order. */
+static int detectParallel(const uint8_t *m, int start, int end) {
+    struct detectorPool *pool = &Modes.pool;
+    int segments = (end - start) / MODES_MIN_SEGMENT;
+
+    if (segments > Modes.threads) segments = Modes.threads;
+    pthread_mutex_lock(&pool->mutex);
+    pool->m = m;
+    pool->start = start;
+    pool->end = end;
+    pool->segments = segments;
+    pool->seglen = ((end + segments - 1) / segments + 63) & ~63;
+    pool->pending = segments - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    scanSegment(0);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return mergeSegments();
+}
+
+/* Smallest amplitude with at least percent of the values at or below it */
+static int baselinePercentile(const struct baselineHistogram *h, double percent) {
+    uint64_t target = (uint64_t) ceil(h->count * percent / 100.0);
+    uint64_t seen = 0;
+    int v;
+
+    if (target < 1) target = 1;
+    for (v = 0; v < 255; v++) {
+        seen += h->bin[v];
+        if (seen >= target) break;
+    }
+    return v;
+}
+
+static void printBaselineHistogram(const char *name, const struct baselineHistogram *h) {
+    reportPrintf("Baseline %s amplitudes: %llu, mean %.1f, median %d", name,
+        (unsigned long long) h->count, (double) h->sum / h->count, baselinePercentile(h, 50));
+    for (int j = 0; j < Modes.bl_percentiles; j++) {
+        reportPrintf(", p%g %d", Modes.bl_percentile[j], baselinePercentile(h, Modes.bl_percentile[j]));
+    }
+    reportPrintf("\n");
+}
+
+/* Recommendations from all accepted messages so far. Pulses below the lowest
+ * percentile and noise above the highest are left out, so single outliers don't
+ * move them like they move a mean. mpa and mnf are compared with <= and >= in
+ * checkP1, hence the one step margin. */
+void printBaseline(void) {
+    const struct baselineHistogram *pulse = &Modes.baseline[BASELINE_PULSE];
+    const struct baselineHistogram *nf = &Modes.baseline[BASELINE_NF];
+    const struct baselineHistogram *nfclose = &Modes.baseline[BASELINE_NFCLOSE];
+    float low = Modes.bl_percentile[0];
+    float high = Modes.bl_percentile[Modes.bl_percentiles-1];
+    int v;
+
+    if (pulse->count > 2)
+    {
+        printBaselineHistogram("pulse", pulse);
+        v = baselinePercentile(pulse, low) - 1;
+        reportPrintf("Recommended minimum pulse amplitude (mpa): %d\n", v < 0 ? 0 : v);
+    }
+    if (nf->count > 2)
+    {
+        printBaselineHistogram("noice floor", nf);
+        v = baselinePercentile(nf, high) + 1;
+        reportPrintf("Recommended maximum noice floor (mnf): %d\n", v > 255 ? 255 : v);
+    }
+    if (nfclose->count > 2)
+    {
+        printBaselineHistogram("close noice floor", nfclose);
+        v = baselinePercentile(nfclose, high) + 1;
+        reportPrintf("Recommended maximum close pulse proximity noice floor (mnfc): %d\n", v > 255 ? 255 : v);
+    }
+}
+
+/* Detects and counts different mode a, c and s messages from magnitude vector data.
+* Baseline mode calculates averages of accepted messages and outputs baseline values
+* that can be used later on.
+* Scanning starts from sample start and stops where the longest pattern no longer fits
+* in the buffer. Returns the next sample that should be scanned, which can be past the
+* end of the buffer if a message was detected near the end.
+* Positions that can't have a P1 pulse are rejected beforehand in bulk by the candidate
+* bits the magnitude stage set along with the magnitudes, full checks only run on the
+* remaining positions. The bits are set again here if the thresholds have become
+* tighter since. Large blocks are split to segments scanned by several threads. */
+int detectMode(uint8_t *m, uint32_t mlen, int start) {
+    int next = mlen;
+
+    if (Modes.freq == 1030000000)
+    {
+        int end = (int) mlen - Modes.timing.len_s + 1;
+
+        /* Printing all data has to visit every position in order */
+        if (Modes.print_all == false && Modes.threads > 1 && end - start >= 2*MODES_MIN_SEGMENT)
+        {
+            next = detectParallel(m, start, end);
+        }
+        else
+        {
+            if (Modes.print_all == false && end > 0 && Modes.candidates_stale)
+            {
+                Modes.candidate_kernel(m, end, Modes.candidates, currentThresholds());
+            }
+            next = Modes.scan_range(m, start, end, NULL);
+        }
+
+        if (Modes.baselinemode == true)
+        {
+            printBaseline();
+        }
+    }
+    return next;
+}
+
+/* Keeps the position the next block is scanned from. The magnitude stage places the
+* last MODES_PATTERN_LEN magnitudes of this block in front of the next one, so the
+* positions not scanned here and patterns that straddle two blocks are there too. */
+void carryTail(uint32_t mlen, int next) {
+    Modes.in->scan_start = next - (mlen - MODES_PATTERN_LEN);
+    Modes.in->sample_base += mlen - MODES_PATTERN_LEN;
+}
+
+/* Hands the thresholds of the next blocks of an input to its magnitude stage for
+* the candidate bits. The stage runs blocks ahead, so adaptive thresholds are handed
+* over MODES_ADAPT_FRONT_SLACK looser to still cover them after they have moved. */
+void publishThresholds(struct input *in) {
+    uint32_t thresholds = currentThresholds();
+
+    if (Modes.adaptive == true) {
+        thresholds = packThresholds(Modes.diff,
+            in->adapt.mpa > MODES_ADAPT_FRONT_SLACK ? in->adapt.mpa - MODES_ADAPT_FRONT_SLACK : 0,
+            in->adapt.mnf < 255 - MODES_ADAPT_FRONT_SLACK ? in->adapt.mnf + MODES_ADAPT_FRONT_SLACK : 255,
+            in->adapt.mnfc < 255 - MODES_ADAPT_FRONT_SLACK ? in->adapt.mnfc + MODES_ADAPT_FRONT_SLACK : 255);
+    }
+    in->thresholds.store(thresholds, std::memory_order_relaxed);
+}
+
+/* Skips samples of capture blocks dropped before the next block. They still count
+* for sample numbers and times, but the tail in front of the block came before the
+* gap, so scanning starts from the block's own samples. */
+void skipGap(uint64_t samples) {
+    Modes.in->sample_base += samples;
+    Modes.in->scan_start = MODES_PATTERN_LEN;
+}
+
+/* Moves mpa, mnf and mnfc with the signal levels between blocks. The noise level
+ * is the median magnitude of the block, which is noise as long as pulses take less
+ * than half of the time. The pulse level is the median of the pulse amplitudes of
+ * accepted messages, which the thresholds hardly move since most pulses are well
+ * above mpa. Both are smoothed over blocks. The thresholds follow the pulse level
+ * but never come closer to the noise than MODES_ADAPT_NOISE_FACTOR, since noise
+ * positions also catch pulse edges and overlapping interrogations. Without enough
+ * pulses for a second of samples the pulse level decays, so a falling gain can't
+ * leave mpa above every pulse for good. */
+void adaptThresholds(const uint8_t *m, uint32_t mlen) {
+    struct adaptiveState *a = &Modes.in->adapt;
+    struct baselineHistogram block;
+    uint64_t now = Modes.in->sample_base;
+    float alpha = a->started ? MODES_ADAPT_SMOOTHING : 1;
+    int floor, mpa, mnf, mnfc;
+
+    memset(&block, 0, sizeof(block));
+    for (uint32_t j = 0; j < mlen; j += MODES_ADAPT_STRIDE) block.bin[m[j]]++;
+    block.count = (mlen + MODES_ADAPT_STRIDE - 1) / MODES_ADAPT_STRIDE;
+    if (block.count == 0) return;
+    a->noise += alpha * (baselinePercentile(&block, 50) - a->noise);
+
+    if (a->pending_count >= MODES_ADAPT_MIN_PULSES) {
+        float level;
+
+        memcpy(block.bin, a->pending, sizeof(block.bin));
+        block.count = a->pending_count;
+        level = baselinePercentile(&block, 50);
+        a->pulse += (a->pulse > 0 ? MODES_ADAPT_SMOOTHING : 1) * (level - a->pulse);
+        memset(a->pending, 0, sizeof(a->pending));
+        a->pending_count = 0;
+        a->pending_since = now;
+    } else if (now - a->pending_since >= (uint64_t) Modes.samplerate) {
+        a->pulse -= MODES_ADAPT_SMOOTHING * a->pulse;
+        a->pending_since = now;
+    }
+    a->started = true;
+
+    floor = (int) lroundf(a->noise * MODES_ADAPT_NOISE_FACTOR) + 1;
+    if (floor < MODES_ADAPT_MIN_NOISE) floor = MODES_ADAPT_MIN_NOISE;
+    if (floor > 254) floor = 254;
+    mpa = (int) lroundf(a->pulse * MODES_ADAPT_PULSE_SHARE);
+    if (mpa < floor) mpa = floor;
+    if (mpa > 254) mpa = 254;
+    mnf = (int) lroundf(a->pulse * MODES_ADAPT_NOISE_SHARE);
+    if (mnf < floor) mnf = floor;
+    if (mnf > 255) mnf = 255;
+    mnfc = (int) lroundf(a->pulse * MODES_ADAPT_CLOSE_SHARE);
+    if (mnfc < mnf) mnfc = mnf;
+    if (mnfc > 255) mnfc = 255;
+    a->mpa = mpa;
+    a->mnf = mnf;
+    a->mnfc = mnfc;
+    Modes.max_noicefloor = mnf;
+    Modes.min_peak_amp = mpa;
+    Modes.max_noicefloor_close = mnfc;
+}
+
+/* Prints help */
+void showHelp(void) {
+    printf("Commands:\n"
+    "--device           Input rtl-sdr device index, or several separated by commas\n"
+    "--file             Input location and full name of test file that is used instead of rtl-sdr device, a FIFO, or - for standard input. Processed in windows of --size bytes. Can be given several times\n"
+    "--format           Sample format of --file: cu8 (default, rtl-sdr), cs8, cs16 or cf32 in host byte order\n"
+    "--scale            Multiplies magnitudes before they are saturated to 255, for example 4 to bring weak signals of a cs16 recording up (default 1)\n"
+    "--replay           fast (default) processes the file as fast as possible without dropping anything, paced at the sample rate like a device\n"
+    "--rate             Sample rate, 2000000, 2400000, 2500000 (default) or 3200000. Higher rates give finer pulse timing\n"
+    "--gain             Input desired gain level for rtl-sdr device\n"
+    "--agc              Enable automatic gain control by RTL-SDR device\n"
+    "--diff             Add minimum amplitude difference between pulses and non pulses that not right next to pulses\n"
+    "--diffclose        Add minimum amplitude difference between pulses and non pulses right next to pulses\n"
+    "--diffratio        Add minimum ratio of non pulse amplitude divided by pulse amplitude for every non pulse value not right next to pulse\n"
+    "--diffratioclose   Add minimum ratio of non pulse amplitude divided by pulse amplitude for every non pulse value right next to pulse\n"
+    "--diffratiop4      Same as diffratio but only for p4 check (Mode a/c only all-call and Mode a/c/s all-call (Compatibility mode) messages)\n"
+    "Compares only p4 pulse values with non pulse values that are after p3 but not next to pulse values.\n"
+    "--diffratioclosep4 Same as diffratio but only for p4 check (Mode a/c only all-call and Mode a/c/s all-call (Compatibility mode) messages)\n"
+    "Compares only p4 pulse values with non pulse values that are after p3 and next to pulse values.\n"
+    "--msgs             Show every recognized messages location and amplitude values in the message\n"
+    "--order            Print order of different SSR interrogation signals of every block as runs of one type with their sample indexes. Works with --continuous too.\n"
+    "--mpa              Minimum accepted pulse amplitude when there should be a pulse\n"
+    "--mnf              Maximum allowed noicefloor amplitude when there shouldn't be a pulse\n"
+    "--mnfc             Maximum allowed noicefloor amplitude when there shouldn't be a pulse right next to pulse\n"
+    "--size             Defines size of read message when using rtl-sdr or file window size. Must be at least 16384 otherwise uses default size of 262 144.\n"
+    "--blmode           Outputs baseline values for mpa, mnf and mnfc based on accepted messages.\n"
+    "--adaptive         Adjust mpa, mnf and mnfc between blocks to the noise floor and pulse amplitudes of accepted messages. Given values are used for the first block.\n"
+    "--blpercentiles    Baseline percentiles to print, for example 5,50,95 (default). mpa is recommended from the lowest, mnf and mnfc from the highest.\n"
+    "--print            Print all captured amplitude data.\n"
+    "--continuous       Keeps detecting and reporting messages continuously. Size parameter sets update interval.\n"
+    "--threads          Number of threads detecting messages from a block. Defaults to number of cores.\n"
+    "--affinity         CPUs for reader, magnitude, detector, reporter, event writer and recorder threads, for example 0,1,2,3,4,5. -1 leaves a thread unpinned.\n"
+    "--stats            Print message rates, inter-arrival times and runs of each message type every given seconds of samples and at exit\n"
+    "--profile          Print latency histograms of every stage at exit and on SIGUSR1. Needs a build made with make PROFILE=1\n"
+    "--metrics          Serve Prometheus metrics over HTTP on a localhost port, or on a Unix socket if given a path\n"
+    "--control          Unix socket for reading and changing thresholds, gain and AGC while running, and for counters\n"
+    "--events           Write every detected message as an event record with absolute sample index and time to a file or FIFO\n"
+    "--events-format    Event record format, json (JSON Lines, default) or binary (24 byte records)\n"
+    "--record           Write the raw I/Q stream of the rtl-sdr device to a file while detecting, for later runs with --file\n"
+    "--record-size      Start a new recording file <path>.0000, <path>.0001, ... after this many megabytes\n"
+    "--record-seconds   Start a new recording file after this many seconds of samples\n"
+    "--help             Show this help\n");
+}
+
+/* Turns I/Q pairs to positive amplitude values with help of magnitude table.
+ * Portable kernel, also used for the tail of the SIMD kernels. */
+void computeMagnitudeScalar(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    uint32_t j;
+    for (j = 0; j < pairs; j++) {
+        int i = p[2*j]-127;
+        int q = p[2*j+1]-127;
+
+        if (i < 0) i = -i;
+        if (q < 0) q = -q;
+        m[j] = Modes.maglut[i*129+q];
+    }
+}
+
+/* Kernels of the other input formats calculate round(sqrt(i*i+q*q)*Modes.mag_scale)
+ * in single precision, saturated to 255. Zero is raised to one like in the table. */
+static inline uint8_t magnitudeClamp(float v) {
+    if (!(v < 255.0f)) return 255;
+    if (v < 1.0f) return 1;
+    return (uint8_t) v;
+}
+
+void computeMagnitudeCS8Scalar(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const int8_t *s = (const int8_t *) p;
+    const float scale = Modes.mag_scale;
+
+    for (uint32_t j = 0; j < pairs; j++) {
+        int i = s[2*j];
+        int q = s[2*j+1];
+
+        m[j] = magnitudeClamp(sqrtf((float) (i*i + q*q)) * scale + 0.5f);
+    }
+}
+
+void computeMagnitudeCS16Scalar(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const int16_t *s = (const int16_t *) p;
+    const float scale = Modes.mag_scale;
+
+    for (uint32_t j = 0; j < pairs; j++) {
+        /* -32768 is taken as -32767 so the sum of squares fits in 32 bits */
+        int i = s[2*j] < -32767 ? -32767 : s[2*j];
+        int q = s[2*j+1] < -32767 ? -32767 : s[2*j+1];
+
+        m[j] = magnitudeClamp(sqrtf((float) (i*i + q*q)) * scale + 0.5f);
+    }
+}
+
+void computeMagnitudeCF32Scalar(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const float *f = (const float *) p;
+    const float scale = Modes.mag_scale;
+
+    for (uint32_t j = 0; j < pairs; j++) {
+        float i = f[2*j];
+        float q = f[2*j+1];
+
+        m[j] = magnitudeClamp(sqrtf(i*i + q*q) * scale + 0.5f);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* The SIMD kernels calculate round(sqrt(i*i+q*q)*Modes.mag_scale) in single precision,
+ * which gives the same value as the magnitude table for every I/Q pair. This is
+ * verified against the table at startup before a kernel is taken into use. */
+
+/* 8 I/Q pairs (16 bytes) to 8 magnitudes as 16 bit integers */
+__attribute__((target("sse2")))
+static inline __m128i magnitudeSSE2(__m128i iq, __m128 scale) {
+    const __m128i bias = _mm_set1_epi8(127);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    /* |x-127| with saturating subtractions */
+    __m128i d = _mm_or_si128(_mm_subs_epu8(iq, bias), _mm_subs_epu8(bias, iq));
+    __m128i lo = _mm_unpacklo_epi8(d, zero);
+    __m128i hi = _mm_unpackhi_epi8(d, zero);
+    /* i*i+q*q of neighbouring 16 bit values */
+    __m128 flo = _mm_cvtepi32_ps(_mm_madd_epi16(lo, lo));
+    __m128 fhi = _mm_cvtepi32_ps(_mm_madd_epi16(hi, hi));
+    flo = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(flo), scale), half);
+    fhi = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(fhi), scale), half);
+    return _mm_packs_epi32(_mm_cvttps_epi32(flo), _mm_cvttps_epi32(fhi));
+}
+
+/* 32 I/Q pairs per iteration, zero amplitudes are raised to one like in the table */
+__attribute__((target("sse2")))
+void computeMagnitudeSSE2(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128 scale = _mm_set1_ps((float) Modes.mag_scale);
+    uint32_t j;
+    for (j = 0; j + 32 <= pairs; j += 32) {
+        const __m128i *in = (const __m128i *) (p + 2*j);
+        __m128i a = magnitudeSSE2(_mm_loadu_si128(in), scale);
+        __m128i b = magnitudeSSE2(_mm_loadu_si128(in + 1), scale);
+        __m128i c = magnitudeSSE2(_mm_loadu_si128(in + 2), scale);
+        __m128i d = magnitudeSSE2(_mm_loadu_si128(in + 3), scale);
+        _mm_storeu_si128((__m128i *) (m + j), _mm_max_epu8(_mm_packus_epi16(a, b), one));
+        _mm_storeu_si128((__m128i *) (m + j + 16), _mm_max_epu8(_mm_packus_epi16(c, d), one));
+    }
+    computeMagnitudeScalar(p + 2*j, m + j, pairs - j);
+}
+
+/* 16 I/Q pairs (32 bytes) to 16 magnitudes as 16 bit integers. Packing works
+ * inside 128 bit lanes, but as both halves come from the same lane the
+ * result is in order. */
+__attribute__((target("avx2")))
+static inline __m256i magnitudeAVX2(__m256i iq, __m256 scale) {
+    const __m256i bias = _mm256_set1_epi8(127);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    __m256i d = _mm256_or_si256(_mm256_subs_epu8(iq, bias), _mm256_subs_epu8(bias, iq));
+    __m256i lo = _mm256_unpacklo_epi8(d, zero);
+    __m256i hi = _mm256_unpackhi_epi8(d, zero);
+    __m256 flo = _mm256_cvtepi32_ps(_mm256_madd_epi16(lo, lo));
+    __m256 fhi = _mm256_cvtepi32_ps(_mm256_madd_epi16(hi, hi));
+    flo = _mm256_add_ps(_mm256_mul_ps(_mm256_sqrt_ps(flo), scale), half);
+    fhi = _mm256_add_ps(_mm256_mul_ps(_mm256_sqrt_ps(fhi), scale), half);
+    return _mm256_packs_epi32(_mm256_cvttps_epi32(flo), _mm256_cvttps_epi32(fhi));
+}
+
+/* 64 I/Q pairs per iteration. The final byte pack interleaves the 128 bit
+ * lanes of its inputs, which is undone with a 64 bit permute. */
+__attribute__((target("avx2")))
+void computeMagnitudeAVX2(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256 scale = _mm256_set1_ps((float) Modes.mag_scale);
+    uint32_t j;
+    for (j = 0; j + 64 <= pairs; j += 64) {
+        const __m256i *in = (const __m256i *) (p + 2*j);
+        __m256i a = magnitudeAVX2(_mm256_loadu_si256(in), scale);
+        __m256i b = magnitudeAVX2(_mm256_loadu_si256(in + 1), scale);
+        __m256i c = magnitudeAVX2(_mm256_loadu_si256(in + 2), scale);
+        __m256i d = magnitudeAVX2(_mm256_loadu_si256(in + 3), scale);
+        __m256i lo = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+        __m256i hi = _mm256_permute4x64_epi64(_mm256_packus_epi16(c, d), 0xd8);
+        _mm256_storeu_si256((__m256i *) (m + j), _mm256_max_epu8(lo, one));
+        _mm256_storeu_si256((__m256i *) (m + j + 32), _mm256_max_epu8(hi, one));
+    }
+    computeMagnitudeScalar(p + 2*j, m + j, pairs - j);
+}
+
+/* Sums of squares to magnitudes as 32 bit integers, clamped like magnitudeClamp.
+ * The minimum keeps NaN at 255 like the scalar kernels. */
+__attribute__((target("sse2")))
+static inline __m128i magnitudeFinishSSE2(__m128 squares, __m128 scale) {
+    __m128 v = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(squares), scale), _mm_set1_ps(0.5f));
+
+    return _mm_cvttps_epi32(_mm_min_ps(v, _mm_set1_ps(255.0f)));
+}
+
+/* Four 32 bit magnitudes of each input to 16 bytes, zeros raised to one */
+__attribute__((target("sse2")))
+static inline __m128i magnitudePackSSE2(__m128i a, __m128i b, __m128i c, __m128i d) {
+    __m128i v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+
+    return _mm_max_epu8(v, _mm_set1_epi8(1));
+}
+
+/* 16 signed 8 bit I/Q pairs per iteration, sign extended to 16 bits for the
+ * multiply-add of I*I+Q*Q */
+__attribute__((target("sse2")))
+void computeMagnitudeCS8SSE2(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const __m128 scale = _mm_set1_ps((float) Modes.mag_scale);
+    uint32_t j;
+
+    for (j = 0; j + 16 <= pairs; j += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (p + 2*j));
+        __m128i y = _mm_loadu_si128((const __m128i *) (p + 2*j + 16));
+        __m128i xl = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+        __m128i xh = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+        __m128i yl = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+        __m128i yh = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+
+        _mm_storeu_si128((__m128i *) (m + j), magnitudePackSSE2(
+            magnitudeFinishSSE2(_mm_cvtepi32_ps(_mm_madd_epi16(xl, xl)), scale),
+            magnitudeFinishSSE2(_mm_cvtepi32_ps(_mm_madd_epi16(xh, xh)), scale),
+            magnitudeFinishSSE2(_mm_cvtepi32_ps(_mm_madd_epi16(yl, yl)), scale),
+            magnitudeFinishSSE2(_mm_cvtepi32_ps(_mm_madd_epi16(yh, yh)), scale)));
+    }
+    computeMagnitudeCS8Scalar(p + 2*j, m + j, pairs - j);
+}
+
+/* 16 signed 16 bit I/Q pairs per iteration */
+__attribute__((target("sse2")))
+static inline __m128i squaresCS16SSE2(const unsigned char *p, __m128 scale) {
+    __m128i x = _mm_max_epi16(_mm_loadu_si128((const __m128i *) p), _mm_set1_epi16(-32767));
+
+    return magnitudeFinishSSE2(_mm_cvtepi32_ps(_mm_madd_epi16(x, x)), scale);
+}
+
+__attribute__((target("sse2")))
+void computeMagnitudeCS16SSE2(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const __m128 scale = _mm_set1_ps((float) Modes.mag_scale);
+    uint32_t j;
+
+    for (j = 0; j + 16 <= pairs; j += 16) {
+        const unsigned char *in = p + 4*j;
+
+        _mm_storeu_si128((__m128i *) (m + j), magnitudePackSSE2(squaresCS16SSE2(in, scale), squaresCS16SSE2(in + 16, scale),
+            squaresCS16SSE2(in + 32, scale), squaresCS16SSE2(in + 48, scale)));
+    }
+    computeMagnitudeCS16Scalar(p + 4*j, m + j, pairs - j);
+}
+
+/* 16 float I/Q pairs per iteration. Squares of two vectors are split to I and Q
+ * with shuffles so they are added in the same order as in the scalar kernel. */
+__attribute__((target("sse2")))
+static inline __m128i squaresCF32SSE2(const unsigned char *p, __m128 scale) {
+    __m128 a = _mm_loadu_ps((const float *) p);
+    __m128 b = _mm_loadu_ps((const float *) (p + 16));
+
+    a = _mm_mul_ps(a, a);
+    b = _mm_mul_ps(b, b);
+    return magnitudeFinishSSE2(_mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+        _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), scale);
+}
+
+__attribute__((target("sse2")))
+void computeMagnitudeCF32SSE2(const unsigned char *p, uint8_t *m, uint32_t pairs) {
+    const __m128 scale = _mm_set1_ps((float) Modes.mag_scale);
+    uint32_t j;
+
+    for (j = 0; j + 16 <= pairs; j += 16) {
+        const unsigned char *in = p + 8*j;
+
+        _mm_storeu_si128((__m128i *) (m + j), magnitudePackSSE2(squaresCF32SSE2(in, scale), squaresCF32SSE2(in + 32, scale),
+            squaresCF32SSE2(in + 64, scale), squaresCF32SSE2(in + 96, scale)));
+    }
+    computeMagnitudeCF32Scalar(p + 8*j, m + j, pairs - j);
+}
+#endif
+
+/* P1 candidates are the positions passing the integer part of the first check in
+ * detectAt: both P1 samples above the minimum pulse amplitude and more than diff
+ * above the following non pulse samples, which have to be under the noise floors.
+ * Ratio checks are left to detectAt. */
+template<int Rate>
+void computeCandidatesScalar(const uint8_t *m, uint32_t n, uint64_t *mask, uint32_t thresholds) {
+    constexpr struct sampleTiming t = timingAt(Rate);
+    const int diff = thresholds & 0xff;
+    const int mpa = thresholds >> 8 & 0xff;
+    const int mnf = thresholds >> 16 & 0xff;
+    const int mnfc = thresholds >> 24;
+    uint32_t j;
+
+    memset(mask, 0, (n + 63)/64*8);
+    for (j = 0; j < n; j++) {
+        const uint8_t *p = m + j;
+        int pulse = p[0] < p[t.w-1] ? p[0] : p[t.w-1];
+        int noise = p[t.w];
+
+        if (p[t.w+1] > noise) noise = p[t.w+1];
+        if (p[t.p2-1] > noise) noise = p[t.p2-1];
+        if (p[t.p2+t.w] > noise) noise = p[t.p2+t.w];
+        if (pulse > noise + diff && pulse > mpa && p[t.w] < mnfc && p[t.w+1] < mnf)
+        {
+            mask[j >> 6] |= 1ULL << (j & 63);
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Candidate bits of 16 positions. a > b for unsigned bytes is tested as a
+ * non-zero saturating a-b, and the sum noise+diff saturates at 255 where
+ * no pulse can be above it. */
+template<int Rate>
+__attribute__((target("sse2")))
+static inline uint32_t candidatesSSE2(const uint8_t *p, __m128i diff, __m128i mpa, __m128i mnf, __m128i mnfc) {
+    constexpr struct sampleTiming t = timingAt(Rate);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i nc = _mm_loadu_si128((const __m128i *) (p + t.w));
+    __m128i n = _mm_loadu_si128((const __m128i *) (p + t.w + 1));
+    __m128i pulse = _mm_min_epu8(_mm_loadu_si128((const __m128i *) p), _mm_loadu_si128((const __m128i *) (p + t.w - 1)));
+    __m128i noise = _mm_max_epu8(_mm_max_epu8(nc, n),
+        _mm_max_epu8(_mm_loadu_si128((const __m128i *) (p + t.p2 - 1)), _mm_loadu_si128((const __m128i *) (p + t.p2 + t.w))));
+    __m128i fail = _mm_cmpeq_epi8(_mm_subs_epu8(pulse, _mm_adds_epu8(noise, diff)), zero);
+
+    fail = _mm_or_si128(fail, _mm_cmpeq_epi8(_mm_subs_epu8(pulse, mpa), zero));
+    fail = _mm_or_si128(fail, _mm_cmpeq_epi8(_mm_subs_epu8(mnfc, nc), zero));
+    fail = _mm_or_si128(fail, _mm_cmpeq_epi8(_mm_subs_epu8(mnf, n), zero));
+    return ~_mm_movemask_epi8(fail) & 0xffff;
+}
+
+/* 64 positions per mask word, last partial word with the scalar kernel */
+template<int Rate>
+__attribute__((target("sse2")))
+void computeCandidatesSSE2(const uint8_t *m, uint32_t n, uint64_t *mask, uint32_t thresholds) {
+    const __m128i diff = _mm_set1_epi8(thresholds & 0xff);
+    const __m128i mpa = _mm_set1_epi8(thresholds >> 8 & 0xff);
+    const __m128i mnf = _mm_set1_epi8(thresholds >> 16 & 0xff);
+    const __m128i mnfc = _mm_set1_epi8(thresholds >> 24);
+    uint32_t j;
+
+    for (j = 0; j + 64 <= n; j += 64) {
+        mask[j >> 6] = (uint64_t) candidatesSSE2<Rate>(m + j, diff, mpa, mnf, mnfc) |
+            (uint64_t) candidatesSSE2<Rate>(m + j + 16, diff, mpa, mnf, mnfc) << 16 |
+            (uint64_t) candidatesSSE2<Rate>(m + j + 32, diff, mpa, mnf, mnfc) << 32 |
+            (uint64_t) candidatesSSE2<Rate>(m + j + 48, diff, mpa, mnf, mnfc) << 48;
+    }
+    if (j < n) computeCandidatesScalar<Rate>(m + j, n - j, mask + (j >> 6), thresholds);
+}
+
+template<int Rate>
+__attribute__((target("avx2")))
+static inline uint32_t candidatesAVX2(const uint8_t *p, __m256i diff, __m256i mpa, __m256i mnf, __m256i mnfc) {
+    constexpr struct sampleTiming t = timingAt(Rate);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i nc = _mm256_loadu_si256((const __m256i *) (p + t.w));
+    __m256i n = _mm256_loadu_si256((const __m256i *) (p + t.w + 1));
+    __m256i pulse = _mm256_min_epu8(_mm256_loadu_si256((const __m256i *) p), _mm256_loadu_si256((const __m256i *) (p + t.w - 1)));
+    __m256i noise = _mm256_max_epu8(_mm256_max_epu8(nc, n),
+        _mm256_max_epu8(_mm256_loadu_si256((const __m256i *) (p + t.p2 - 1)), _mm256_loadu_si256((const __m256i *) (p + t.p2 + t.w))));
+    __m256i fail = _mm256_cmpeq_epi8(_mm256_subs_epu8(pulse, _mm256_adds_epu8(noise, diff)), zero);
+
+    fail = _mm256_or_si256(fail, _mm256_cmpeq_epi8(_mm256_subs_epu8(pulse, mpa), zero));
+    fail = _mm256_or_si256(fail, _mm256_cmpeq_epi8(_mm256_subs_epu8(mnfc, nc), zero));
+    fail = _mm256_or_si256(fail, _mm256_cmpeq_epi8(_mm256_subs_epu8(mnf, n), zero));
+    return ~(uint32_t) _mm256_movemask_epi8(fail);
+}
+
+template<int Rate>
+__attribute__((target("avx2")))
+void computeCandidatesAVX2(const uint8_t *m, uint32_t n, uint64_t *mask, uint32_t thresholds) {
+    const __m256i diff = _mm256_set1_epi8(thresholds & 0xff);
+    const __m256i mpa = _mm256_set1_epi8(thresholds >> 8 & 0xff);
+    const __m256i mnf = _mm256_set1_epi8(thresholds >> 16 & 0xff);
+    const __m256i mnfc = _mm256_set1_epi8(thresholds >> 24);
+    uint32_t j;
+
+    for (j = 0; j + 64 <= n; j += 64) {
+        mask[j >> 6] = (uint64_t) candidatesAVX2<Rate>(m + j, diff, mpa, mnf, mnfc) |
+            (uint64_t) candidatesAVX2<Rate>(m + j + 32, diff, mpa, mnf, mnfc) << 32;
+    }
+    if (j < n) computeCandidatesScalar<Rate>(m + j, n - j, mask + (j >> 6), thresholds);
+}
+#endif
+
+/* Compares candidate kernel against the scalar one on pseudo random data
+ * with the configured thresholds. */
+bool verifyCandidateKernel(candidateKernel kernel, candidateKernel scalar) {
+    const uint32_t n = 4096;
+    vector<uint8_t> m(n + MODES_PATTERN_LEN);
+    vector<uint64_t> expected(n/64), got(n/64);
+    uint32_t seed = 1;
+
+    for (auto &v : m) {
+        seed = seed * 1103515245 + 12345;
+        v = (seed >> 16) % 4 == 0 ? 1 + (seed >> 8) % 255 : (seed >> 20) % 16;
+    }
+    scalar(m.data(), n, expected.data(), currentThresholds());
+    kernel(m.data(), n, got.data(), currentThresholds());
+    return expected == got;
+}
+
+/* Picks the fastest P1 candidate kernel the CPU supports. */
+template<int Rate>
+void selectCandidateKernel(void) {
+    Modes.candidate_kernel = computeCandidatesScalar<Rate>;
+    Modes.candidate_kernel_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        Modes.candidate_kernel = computeCandidatesAVX2<Rate>;
+        Modes.candidate_kernel_name = "AVX2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        Modes.candidate_kernel = computeCandidatesSSE2<Rate>;
+        Modes.candidate_kernel_name = "SSE2";
+    }
+#endif
+    if (Modes.candidate_kernel != computeCandidatesScalar<Rate> &&
+        !verifyCandidateKernel(Modes.candidate_kernel, computeCandidatesScalar<Rate>))
+    {
+        fprintf(stderr, "%s candidate kernel doesn't match scalar kernel, using scalar kernel.\n",
+            Modes.candidate_kernel_name);
+        Modes.candidate_kernel = computeCandidatesScalar<Rate>;
+        Modes.candidate_kernel_name = "scalar";
+    }
+}
+
+/* Takes detector and candidate kernels of one sample rate into use. */
+template<int Rate>
+void useSampleRate(void) {
+    Modes.timing = timingAt(Rate);
+    Modes.detect_at = detectAt<Rate>;
+    Modes.scan_range = scanRange<Rate>;
+    selectCandidateKernel<Rate>();
+}
+
+/* Picks kernels for the sample rate. Returns false if the rate isn't supported. */
+bool selectDetector(int rate) {
+    switch (rate) {
+    case 2000000: useSampleRate<2000000>(); return true;
+    case 2400000: useSampleRate<2400000>(); return true;
+    case 2500000: useSampleRate<2500000>(); return true;
+    case MODES_MAX_RATE: useSampleRate<MODES_MAX_RATE>(); return true;
+    }
+    return false;
+}
+
+/* Checks kernel against the magnitude table with every possible I/Q pair. */
+bool verifyMagnitudeKernel(magnitudeKernel kernel) {
+    vector<unsigned char> iq(2*65536);
+    vector<uint8_t> expected(65536), got(65536);
+
+    for (int j = 0; j < 65536; j++) {
+        iq[2*j] = j >> 8;
+        iq[2*j+1] = j & 0xff;
+    }
+    computeMagnitudeScalar(iq.data(), expected.data(), 65536);
+    kernel(iq.data(), got.data(), 65536);
+    return expected == got;
+}
+
+/* Checks kernel of a wider input format against its scalar kernel. Every cs8
+ * pair, random cs16 pairs and random cf32 pairs reaching past full scale. */
+bool verifyFormatKernel(magnitudeKernel kernel, magnitudeKernel scalar) {
+    vector<unsigned char> in(8*65536);
+    vector<uint8_t> expected(65536), got(65536);
+    uint32_t state = 1;
+
+    for (int j = 0; j < 65536; j++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        if (Modes.format == FORMAT_CS8) {
+            in[2*j] = j >> 8;
+            in[2*j+1] = j & 0xff;
+        } else if (Modes.format == FORMAT_CS16) {
+            ((int16_t *) in.data())[2*j] = state & 0xffff;
+            ((int16_t *) in.data())[2*j+1] = state >> 16;
+        } else {
+            ((float *) in.data())[2*j] = ((int32_t) state >> 8) / 4194304.0f;
+            ((float *) in.data())[2*j+1] = (int16_t) (state & 0xffff) / 16384.0f;
+        }
+    }
+    scalar(in.data(), expected.data(), 65536);
+    kernel(in.data(), got.data(), 65536);
+    return expected == got;
+}
+
+/* Picks the fastest kernel of a cs8, cs16 or cf32 input the CPU supports. */
+void selectFormatKernel(void) {
+    magnitudeKernel scalar = Modes.format == FORMAT_CS8 ? computeMagnitudeCS8Scalar :
+        Modes.format == FORMAT_CS16 ? computeMagnitudeCS16Scalar : computeMagnitudeCF32Scalar;
+
+    Modes.magnitude_kernel = scalar;
+    Modes.magnitude_kernel_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        Modes.magnitude_kernel = Modes.format == FORMAT_CS8 ? computeMagnitudeCS8SSE2 :
+            Modes.format == FORMAT_CS16 ? computeMagnitudeCS16SSE2 : computeMagnitudeCF32SSE2;
+        Modes.magnitude_kernel_name = "SSE2";
+    }
+#endif
+    if (Modes.magnitude_kernel != scalar && !verifyFormatKernel(Modes.magnitude_kernel, scalar))
+    {
+        fprintf(stderr, "%s magnitude kernel doesn't match scalar kernel, using scalar kernel.\n",
+            Modes.magnitude_kernel_name);
+        Modes.magnitude_kernel = scalar;
+        Modes.magnitude_kernel_name = "scalar";
+    }
+}
+
+/* Picks the fastest magnitude kernel the CPU supports. */
+void selectMagnitudeKernel(void) {
+    if (Modes.format != FORMAT_CU8) {
+        selectFormatKernel();
+        return;
+    }
+    Modes.magnitude_kernel = computeMagnitudeScalar;
+    Modes.magnitude_kernel_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        Modes.magnitude_kernel = computeMagnitudeAVX2;
+        Modes.magnitude_kernel_name = "AVX2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        Modes.magnitude_kernel = computeMagnitudeSSE2;
+        Modes.magnitude_kernel_name = "SSE2";
+    }
+#endif
+    if (Modes.magnitude_kernel != computeMagnitudeScalar &&
+        !verifyMagnitudeKernel(Modes.magnitude_kernel))
+    {
+        fprintf(stderr, "%s magnitude kernel doesn't match magnitude table, using scalar kernel.\n",
+            Modes.magnitude_kernel_name);
+        Modes.magnitude_kernel = computeMagnitudeScalar;
+        Modes.magnitude_kernel_name = "scalar";
+    }
+}
+
+/* Front end of the detector. Turns the I/Q pairs of a block to positive amplitude
+ * values after the MODES_PATTERN_LEN magnitudes in front of m, then sets the P1
+ * candidate bits of m. Two passes over the whole block: setting the bits chunk by
+ * chunk right after converting it was no faster in kernelbench, as the magnitudes
+ * of a block are still in cache for the second pass. */
+void computeFrontEnd(const unsigned char *p, uint32_t pairs, uint8_t *m, uint64_t *mask, uint32_t thresholds) {
+    uint32_t mlen = MODES_PATTERN_LEN + pairs;
+
+    Modes.magnitude_kernel(p, m + MODES_PATTERN_LEN, pairs);
+    if (mlen >= (uint32_t) Modes.timing.len_s) {
+        Modes.candidate_kernel(m, mlen - Modes.timing.len_s + 1, mask, thresholds);
+    }
+}
+
+void populateMagnitudeTable(void) {
+    uint8_t i;
+    uint8_t q;
+    /* Fill all possible I/Q values to table which saves time and processing power
+     * since program doesn't have to calculate same squareroots or round numbers
+     *
+     * We multiply it by 1.405 to utilize full resolution (0-255), times --scale.
+     * Amplitudes under one, which a small --scale gives for more than the zero
+     * pair, are stored as one like magnitudeClamp does as the ratio checks
+     * divide by them.
+     */
+    Modes.maglut = (uint8_t *) malloc(129*129*2);
+        for (i = 0; i <= 128; i++) {
+            for (q = 0; q <= 128; q++) {
+                double v = round(sqrt(i*i+q*q)*Modes.mag_scale);
+                Modes.maglut[i*129+q] = v > 255 ? 255 : v < 1 ? 1 : v;
+            }
+        }
+    selectMagnitudeKernel();
+    }
+
+/* Prints depth and stall counters of a pipeline queue. Full stalls are waits of
+ * the stage writing to the queue, empty stalls waits of the stage reading it. */
+void printQueueStats(const char *name, struct blockRing *r) {
+    reportPrintf("%-10s queue depth now/max, stalls full/empty:          %u/%u, %llu/%llu\n", name,
+        r->head.load(std::memory_order_relaxed) - r->tail.load(std::memory_order_relaxed),
+        r->max_depth.load(std::memory_order_relaxed),
+        (unsigned long long) r->full_stalls.load(std::memory_order_relaxed),
+        (unsigned long long) r->empty_stalls.load(std::memory_order_relaxed));
+}
+
+/* Prints capture ring and pipeline queue counters. */
+void printRingStats(void) {
+    Modes.in->reported_drops = Modes.in->ring.dropped.load(std::memory_order_relaxed);
+    reportPrintf("Capture blocks received:                                    %llu\n"
+    "Capture blocks processed:                                   %llu\n"
+    "Capture blocks dropped (detector too slow):                 %llu\n",
+        (unsigned long long) Modes.in->ring.enqueued.load(std::memory_order_relaxed) + Modes.in->reported_drops,
+        (unsigned long long) Modes.in->ring.consumed.load(std::memory_order_relaxed),
+        (unsigned long long) Modes.in->reported_drops);
+    printQueueStats("Capture", &Modes.in->ring);
+    printQueueStats("Magnitude", &Modes.in->mag_ring);
+    printQueueStats("Report", &Modes.report_ring);
+    reportPrintf("Output bytes dropped (output too slow):                     %llu\n",
+        (unsigned long long) Modes.report_ring.dropped.load(std::memory_order_relaxed));
+    if (Modes.events_fd >= 0) {
+        printQueueStats("Events", &Modes.event_ring);
+        reportPrintf("Events dropped (event output too slow):                     %llu\n",
+            (unsigned long long) Modes.event_ring.dropped.load(std::memory_order_relaxed));
+    }
+    if (Modes.record_name != NULL) {
+        printQueueStats("Record", &Modes.record_ring);
+        reportPrintf("Recorded bytes written/dropped (disk too slow):             %llu/%llu\n",
+            (unsigned long long) Modes.record_written.load(std::memory_order_relaxed),
+            (unsigned long long) Modes.record_dropped.load(std::memory_order_relaxed));
+    }
+    reportPrintf("\n");
+}
+
+/* Prints sliding window rates, inter-arrival time and run length histograms of
+ * every message type. now is the number of samples processed so far. Histograms
+ * cover the whole capture, only rows with messages are printed. */
+void printTrafficStats(uint64_t now) {
+    static const char *names[MODES_MESSAGE_TYPES + 1] = { "A", "C", "A AC", "C AC", "A ACC", "C ACC", "S", "All" };
+    static const int windows[3] = { 1, 10, 60 };
+    struct trafficStats *st = &Modes.in->traffic;
+    int t;
+    int b;
+    int w;
+
+    /* Windows end at the last processed sample */
+    statsAdvance(now > 0 ? (now - 1) / Modes.samplerate : 0);
+    if (Modes.inputs > 1) reportPrintf("Input %d, %s: ", Modes.in->index, Modes.in->name);
+    reportPrintf("Traffic statistics after %.1f s (AC all-call, ACC all-call compatibility mode):\n%-24s", (double) now / Modes.samplerate, "Rate per second");
+    for (t = 0; t <= MODES_MESSAGE_TYPES; t++) reportPrintf(" %9s", names[t]);
+    reportPrintf("\n");
+    for (w = 0; w < 3; w++) {
+        /* Window ends at now and starts windows[w]-1 whole seconds before the current one */
+        uint64_t first = st->second + 1 > (uint64_t) windows[w] ? st->second + 1 - windows[w] : 0;
+        double seconds = (double) (now - first * Modes.samplerate) / Modes.samplerate;
+
+        reportPrintf("  last %2d s%-14s", windows[w], "");
+        for (t = 0; t <= MODES_MESSAGE_TYPES; t++) {
+            uint64_t sum = 0;
+
+            for (uint64_t s = first; s <= st->second; s++) sum += st->window[s & (MODES_RATE_SECONDS - 1)][t];
+            reportPrintf(" %9.1f", seconds > 0 ? sum / seconds : 0.0);
+        }
+        reportPrintf("\n");
+    }
+
+    reportPrintf("%-24s", "Inter-arrival time (us)");
+    for (t = 0; t <= MODES_MESSAGE_TYPES; t++) reportPrintf(" %9s", names[t]);
+    reportPrintf("\n");
+    for (b = 0; b < MODES_LOG_BUCKETS; b++) {
+        uint64_t any = 0;
+
+        for (t = 0; t <= MODES_MESSAGE_TYPES; t++) any += st->interarrival[t][b];
+        if (any == 0) continue;
+        reportPrintf("  %10llu-%-10llu ", b ? 1ULL << b : 0ULL, (2ULL << b) - 1);
+        for (t = 0; t <= MODES_MESSAGE_TYPES; t++) reportPrintf(" %9llu", (unsigned long long) st->interarrival[t][b]);
+        reportPrintf("\n");
+    }
+
+    /* The current run is shown as if it ended now and taken back out afterwards */
+    if (st->run_type >= 0) statsRun(st->run_type, st->run_length);
+    reportPrintf("%-24s", "Messages in a row");
+    for (t = 0; t < MODES_MESSAGE_TYPES; t++) reportPrintf(" %9s", names[t]);
+    reportPrintf("\n");
+    for (b = 0; b < MODES_LOG_BUCKETS; b++) {
+        uint64_t any = 0;
+
+        for (t = 0; t < MODES_MESSAGE_TYPES; t++) any += st->runs[t][b];
+        if (any == 0) continue;
+        reportPrintf("  %10llu-%-10llu ", b ? 1ULL << b : 1ULL, (2ULL << b) - 1);
+        for (t = 0; t < MODES_MESSAGE_TYPES; t++) reportPrintf(" %9llu", (unsigned long long) st->runs[t][b]);
+        reportPrintf("\n");
+    }
+    reportPrintf("  %-22s", "mean");
+    for (t = 0; t < MODES_MESSAGE_TYPES; t++) reportPrintf(" %9.1f", st->run_count[t] ? (double) st->run_total[t] / st->run_count[t] : 0.0);
+    reportPrintf("\n  %-22s", "longest");
+    for (t = 0; t < MODES_MESSAGE_TYPES; t++) reportPrintf(" %9llu", (unsigned long long) st->run_max[t]);
+    reportPrintf("\n\n");
+    if (st->run_type >= 0) {
+        st->runs[st->run_type][logBucket(st->run_length)]--;
+        st->run_total[st->run_type] -= st->run_length;
+        st->run_count[st->run_type]--;
+    }
+    while (st->next_report <= now) st->next_report += st->interval;
+    st->reported = now;
+}
+
+/* Adds the counts of the block just detected to the metrics. Detector stage only,
+ * called before printStats resets the counts. */
+void metricsPublish(uint64_t block_samples, uint64_t ns) {
+    const int counts[MODES_MESSAGE_TYPES] = { Modes.in->count_a, Modes.in->count_c, Modes.in->count_a_acac, Modes.in->count_c_acac,
+                                              Modes.in->count_a_acsac, Modes.in->count_c_acsac, Modes.in->count_s };
+
+    for (int t = 0; t < MODES_MESSAGE_TYPES; t++) {
+        Modes.metric_messages[t].store(Modes.metric_messages[t].load(std::memory_order_relaxed) + counts[t], std::memory_order_relaxed);
+    }
+    Modes.metric_samples.store(Modes.metric_samples.load(std::memory_order_relaxed) + block_samples, std::memory_order_relaxed);
+    Modes.metric_busy_ns.store(Modes.metric_busy_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    Modes.metric_block_ns.store(ns, std::memory_order_relaxed);
+    Modes.metric_block_samples.store(block_samples, std::memory_order_relaxed);
+}
+
+/* Appends the HELP and TYPE lines of a metric in Prometheus text format */
+static void metricsHeader(string &out, const char *name, const char *type, const char *help) {
+    char line[512];
+
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    out += line;
+}
+
+static void metricsValue(string &out, const char *name, const char *labels, double value) {
+    char line[256];
+
+    snprintf(line, sizeof(line), "%s%s %.10g\n", name, labels, value);
+    out += line;
+}
+
+/* Blocks waiting in a ring */
+static uint64_t ringDepth(struct blockRing *r) {
+    return r->blocks == NULL ? 0 : r->head.load(std::memory_order_relaxed) - r->tail.load(std::memory_order_relaxed);
+}
+
+/* Prometheus text format of all metrics. Reads only atomics. Capture counters
+ * and queues are summed over the inputs. */
+static string metricsText(void) {
+    static const int codes[MODES_MESSAGE_TYPES] = { 11, 12, 21, 22, 31, 32, 3 };
+    struct { const char *name; struct blockRing *r; } queues[] = {
+        { "report", &Modes.report_ring }, { "events", &Modes.event_ring }, { "record", &Modes.record_ring },
+    };
+    uint64_t received = 0;
+    uint64_t dropped = 0;
+    uint64_t capture_depth = 0;
+    uint64_t magnitude_depth = 0;
+    uint64_t block_ns = Modes.metric_block_ns.load(std::memory_order_relaxed);
+    double block_seconds = (double) Modes.metric_block_samples.load(std::memory_order_relaxed) / Modes.samplerate;
+    int gain = Modes.metric_gain.load(std::memory_order_relaxed);
+    string out;
+    char labels[64];
+
+    for (int k = 0; k < Modes.inputs; k++) {
+        struct input *in = &Modes.input[k];
+        uint64_t d = in->ring.dropped.load(std::memory_order_relaxed);
+
+        received += in->ring.enqueued.load(std::memory_order_relaxed) + d;
+        dropped += d;
+        capture_depth += ringDepth(&in->ring);
+        magnitude_depth += ringDepth(&in->mag_ring);
+    }
+    metricsHeader(out, "dump1030_samples_processed_total", "counter", "Samples scanned by the detector.");
+    metricsValue(out, "dump1030_samples_processed_total", "", Modes.metric_samples.load(std::memory_order_relaxed));
+    metricsHeader(out, "dump1030_blocks_received_total", "counter", "Capture blocks received from the device or file.");
+    metricsValue(out, "dump1030_blocks_received_total", "", received);
+    metricsHeader(out, "dump1030_blocks_dropped_total", "counter", "Capture blocks dropped because the detector was too slow.");
+    metricsValue(out, "dump1030_blocks_dropped_total", "", dropped);
+    metricsHeader(out, "dump1030_messages_total", "counter", "Detected messages by type.");
+    for (int t = 0; t < MODES_MESSAGE_TYPES; t++) {
+        snprintf(labels, sizeof(labels), "{type=\"%s\"}", eventName(codes[t]));
+        metricsValue(out, "dump1030_messages_total", labels, Modes.metric_messages[t].load(std::memory_order_relaxed));
+    }
+    if (gain != MODES_AUTO_GAIN) {
+        metricsHeader(out, "dump1030_gain_db", "gauge", "Tuner gain reported by the device.");
+        metricsValue(out, "dump1030_gain_db", "", gain / 10.0);
+    }
+    metricsHeader(out, "dump1030_block_processing_seconds", "gauge", "Detector time of the last block.");
+    metricsValue(out, "dump1030_block_processing_seconds", "", block_ns / 1e9);
+    metricsHeader(out, "dump1030_processing_seconds_total", "counter", "Detector time of all blocks.");
+    metricsValue(out, "dump1030_processing_seconds_total", "", Modes.metric_busy_ns.load(std::memory_order_relaxed) / 1e9);
+    metricsHeader(out, "dump1030_realtime_factor", "gauge", "Duration of the last block divided by its detector time. Below 1 the detector falls behind real time.");
+    metricsValue(out, "dump1030_realtime_factor", "", block_ns > 0 ? block_seconds / (block_ns / 1e9) : 0);
+    metricsHeader(out, "dump1030_queue_depth", "gauge", "Blocks waiting in a pipeline queue.");
+    metricsValue(out, "dump1030_queue_depth", "{queue=\"capture\"}", capture_depth);
+    metricsValue(out, "dump1030_queue_depth", "{queue=\"magnitude\"}", magnitude_depth);
+    for (auto &q : queues) {
+        if (q.r->blocks == NULL) continue;
+        snprintf(labels, sizeof(labels), "{queue=\"%s\"}", q.name);
+        metricsValue(out, "dump1030_queue_depth", labels, ringDepth(q.r));
+    }
+    metricsHeader(out, "dump1030_output_bytes_dropped_total", "counter", "Output text dropped because the output was too slow.");
+    metricsValue(out, "dump1030_output_bytes_dropped_total", "", Modes.report_ring.dropped.load(std::memory_order_relaxed));
+    if (Modes.events_fd >= 0) {
+        metricsHeader(out, "dump1030_events_dropped_total", "counter", "Event records dropped because the event output was too slow.");
+        metricsValue(out, "dump1030_events_dropped_total", "", Modes.event_ring.dropped.load(std::memory_order_relaxed));
+    }
+    if (Modes.record_name != NULL) {
+        metricsHeader(out, "dump1030_record_bytes_total", "counter", "Raw I/Q bytes written by --record.");
+        metricsValue(out, "dump1030_record_bytes_total", "", Modes.record_written.load(std::memory_order_relaxed));
+        metricsHeader(out, "dump1030_record_dropped_bytes_total", "counter", "Raw I/Q bytes not recorded because the disk was too slow or writing failed.");
+        metricsValue(out, "dump1030_record_dropped_bytes_total", "", Modes.record_dropped.load(std::memory_order_relaxed));
+    }
+    return out;
+}
+
+/* Metrics thread, answers every HTTP request on the metrics socket with all
+ * metrics. One client at a time, a client that sends nothing is dropped after a second. */
+void *metricsServer(void *) {
+    struct timeval timeout = { 1, 0 };
+    char request[MODES_METRICS_REQUEST];
+
+    while (1) {
+        int fd = accept(Modes.metrics_fd, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "Metrics endpoint stopped: %s\n", strerror(errno));
+            return NULL;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (recv(fd, request, sizeof(request), 0) > 0) {
+            string body = metricsText();
+            char header[256];
+            int n = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\nConnection: close\r\n\r\n", body.size());
+
+            /* MSG_NOSIGNAL so a client closing early can't stop the program */
+            if (send(fd, header, n, MSG_NOSIGNAL) == n) send(fd, body.data(), body.size(), MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Binds a stream socket to a Unix socket path, replacing a stale one. Returns -1 on error. */
+int bindUnix(const char *path) {
+    struct sockaddr_un sun;
+    int fd;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+    unlink(path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Opens the --metrics socket: a TCP port on localhost, or a Unix socket when the
+ * address contains a slash. */
+void metricsInit(void) {
+    int one = 1;
+
+    if (strchr(Modes.metrics_addr, '/') != NULL) {
+        if ((Modes.metrics_fd = bindUnix(Modes.metrics_addr)) < 0) goto error;
+    } else {
+        struct sockaddr_in sin;
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sin.sin_port = htons(atoi(Modes.metrics_addr));
+        Modes.metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (Modes.metrics_fd < 0) goto error;
+        setsockopt(Modes.metrics_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(Modes.metrics_fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) goto error;
+    }
+    if (listen(Modes.metrics_fd, 8) < 0) goto error;
+    pthread_create(&Modes.metrics_thread, NULL, metricsServer, NULL);
+    return;
+
+error:
+    fprintf(stderr, "Error opening metrics endpoint %s: %s\n", Modes.metrics_addr, strerror(errno));
+    exit(1);
+}
+
+/* Parameters of the control socket, named like their command line options.
+ * Gain and AGC have neither a byte nor a ratio. */
+static const struct { const char *name; uint8_t *byte; float *ratio; } controlParams[CONTROL_PARAMS] = {
+    { "diff", &Modes.diff, NULL },
+    { "diffclose", &Modes.diffclose, NULL },
+    { "diffratio", NULL, &Modes.diffratio },
+    { "diffratioclose", NULL, &Modes.diffratioclose },
+    { "diffratiop4", NULL, &Modes.diffratiop4 },
+    { "diffratioclosep4", NULL, &Modes.diffratioclosep4 },
+    { "mpa", &Modes.min_peak_amp, NULL },
+    { "mnf", &Modes.max_noicefloor, NULL },
+    { "mnfc", &Modes.max_noicefloor_close, NULL },
+    { "gain", NULL, NULL },
+    { "agc", NULL, NULL },
+};
+
+/* Parses the name value pairs of a set command to cmd. Every value is checked
+ * here, so the detector can't fail applying them. Returns an error or NULL. */
+static const char *controlParseSet(char *args, struct controlCommand *cmd) {
+    char *save;
+    char *name;
+    bool any = false;
+
+    while ((name = strtok_r(args, " \t", &save)) != NULL) {
+        char *value = strtok_r(NULL, " \t", &save);
+        char *end;
+        double v;
+        int j;
 
-            numgains = rtlsdr_get_tuner_gains(Modes.dev, gains);
-            Modes.gain = gains[numgains-1];
-            fprintf(stderr, "Max available gain is: %.2f\n", Modes.gain/10.0);
+        args = NULL;
+        for (j = 0; j < CONTROL_PARAMS && strcmp(controlParams[j].name, name); j++);
+        if (j == CONTROL_PARAMS) return "unknown parameter";
+        if (value == NULL) return "missing value";
+        v = strtod(value, &end);
+        if (j == PARAM_GAIN || j == PARAM_AGC) {
+            if (Modes.filename != NULL) return "gain and agc need an rtl-sdr device";
+            if (j == PARAM_GAIN && !strcmp(value, "auto")) v = MODES_AUTO_GAIN;
+            else if (j == PARAM_GAIN && !strcmp(value, "max")) v = MODES_MAX_GAIN;
+            else if (j == PARAM_AGC && (!strcmp(value, "on") || !strcmp(value, "off"))) v = !strcmp(value, "on");
+            else if (end == value || *end != '\0') return "gain is auto, max or tenths of dB, agc is on or off";
+            else if (j == PARAM_AGC && v != 0 && v != 1) return "agc is on or off";
+        } else if (end == value || *end != '\0' || !isfinite(v)) {
+            return "value is not a number";
+        } else if (controlParams[j].byte != NULL && (v < 0 || v > 255 || v != floor(v))) {
+            return "value must be a whole number from 0 to 255";
+        } else if (Modes.adaptive == true && (j == PARAM_MPA || j == PARAM_MNF || j == PARAM_MNFC)) {
+            return "mpa, mnf and mnfc follow the signal with --adaptive";
+        } else if (controlParams[j].ratio != NULL) {
+            struct ratioThreshold t;
+
+            if (v < 0) return "ratio can't be negative";
+            populateRatioTable(&t, v);
+            if (!verifyRatioTable(&t, v)) return "integer form of the ratio doesn't match float division";
         }
-        rtlsdr_set_tuner_gain(Modes.dev, Modes.gain);
-        fprintf(stderr, "Setting gain to: %.2f\n", Modes.gain/10.0);
-    } else {
-        fprintf(stderr, "Using automatic gain control.\n");
+        cmd->given[j] = true;
+        cmd->value[j] = v;
+        any = true;
     }
-    rtlsdr_set_freq_correction(Modes.dev, ppm_error);
-    if (Modes.enable_agc) rtlsdr_set_agc_mode(Modes.dev, 1);
-    rtlsdr_set_center_freq(Modes.dev, Modes.freq);
-    rtlsdr_set_sample_rate(Modes.dev, MODES_DEFAULT_RATE);
-    rtlsdr_reset_buffer(Modes.dev);
-    fprintf(stderr, "Gain reported by device: %.2f\n",
-        rtlsdr_get_tuner_gain(Modes.dev)/10.0);
+    return any ? NULL : "set needs a parameter and a value";
 }
 
+/* Appends the cumulative counts of an input or all inputs to a control reply */
+static void controlCounts(string &out, const char *prefix, int first, int last) {
+    static const char *names[] = { "samples", "dropped_blocks", "messages", "mode_a", "mode_c", "mode_a_all_call", "mode_c_all_call",
+        "mode_a_all_call_compat", "mode_c_all_call_compat", "mode_s", "mode_s_56", "mode_s_112" };
+    uint64_t counts[12] = { 0 };
+    char line[128];
 
+    for (int k = first; k <= last; k++) {
+        const struct input *in = &Modes.input[k];
+        uint64_t values[12] = { in->sample_base, in->ring.dropped.load(std::memory_order_relaxed),
+            (uint64_t) in->cumulative_countm, (uint64_t) in->cumulative_count_a, (uint64_t) in->cumulative_count_c,
+            (uint64_t) in->cumulative_count_a_acac, (uint64_t) in->cumulative_count_c_acac,
+            (uint64_t) in->cumulative_count_a_acsac, (uint64_t) in->cumulative_count_c_acsac,
+            (uint64_t) in->cumulative_count_s, (uint64_t) in->cumulative_count_s_short, (uint64_t) in->cumulative_count_s_long };
 
-/* Detects and counts different mode a, c and s messages from magnitude vector data.
-* Checks first simpler and smaller patterns before moving to longer checks.
-* Baseline mode calculates averages of accepted messages and outputs baseline values
-* that can be used later on. */
-void detectMode(uint8_t *m) {
-    int i;
-    int a;
-    int c;
-    int o = 0;
-    int os; /* offset that depends on if it is Mode A or C message.  */
-
-    /* Sets zeroes to ones in amplitude data to avoid floation point exceptions. */
-    for(i = 0; i<Modes.data_length/2; i++) {
-        if (m[i] == 0) { m[i] = 1; }
+        for (int j = 0; j < 12; j++) counts[j] += values[j];
+    }
+    for (int j = 0; j < 12; j++) {
+        snprintf(line, sizeof(line), "%s%s %llu\n", prefix, names[j], (unsigned long long) counts[j]);
+        out += line;
     }
+}
 
-    if (Modes.freq == 1030000000 && Modes.samplerate == 2500000)
-    {
-        vector<uint8_t> averagenf;
-        vector<uint8_t> averagepulse;
-        vector<uint8_t> averagenfclose;
-        for (i = 0; i<Modes.data_length/2; i++) {
+/* Carries out the pending control command. Detector stage only, between blocks,
+ * so the scan and its worker threads always see one set of parameters. */
+void controlApply(void) {
+    struct controlCommand *cmd = &Modes.control;
+    char line[128];
 
-            if (Modes.print_all == true)
-            {
-                printf(" %d", m[i]);
+    pthread_mutex_lock(&Modes.control_mutex);
+    if (Modes.control_pending.load(std::memory_order_relaxed) == false) {
+        /* Gave up waiting already */
+        pthread_mutex_unlock(&Modes.control_mutex);
+        return;
+    }
+    cmd->reply.clear();
+    if (cmd->op == CONTROL_GET) {
+        for (int j = 0; j < CONTROL_PARAMS; j++) {
+            if (controlParams[j].byte != NULL) {
+                snprintf(line, sizeof(line), "%s %d\n", controlParams[j].name, *controlParams[j].byte);
+            } else if (controlParams[j].ratio != NULL) {
+                snprintf(line, sizeof(line), "%s %g\n", controlParams[j].name, *controlParams[j].ratio);
+            } else if (j == PARAM_GAIN) {
+                if (Modes.gain == MODES_AUTO_GAIN) snprintf(line, sizeof(line), "gain auto\n");
+                else if (Modes.gain == MODES_MAX_GAIN) snprintf(line, sizeof(line), "gain max\n");
+                else snprintf(line, sizeof(line), "gain %d\n", Modes.gain);
+            } else {
+                snprintf(line, sizeof(line), "agc %s\n", Modes.enable_agc ? "on" : "off");
             }
+            cmd->reply += line;
+        }
+    } else if (cmd->op == CONTROL_SET) {
+        bool ratios = false;
+        bool tuner = false;
 
-            /* Checks existence of P1 pulse and non pulse values that exist in all Mode A/C/S messages */
-            if  ((float) m[i+2]/m[i] > Modes.diffratioclose || (float) m[i+2]/m[i+1] > Modes.diffratioclose ||
-                (float) m[i+3]/m[i] > Modes.diffratio || (float) m[i+3]/m[i+1] > Modes.diffratio ||
-                 m[i]<=m[i+2]+Modes.diff || m[i+1]<=m[i+2]+Modes.diff ||
-                 m[i]<=m[i+3]+Modes.diff || m[i+1]<=m[i+3]+Modes.diff ||
-                 m[i]<=m[i+4]+Modes.diff || m[i+1]<=m[i+4]+Modes.diff ||
-                 m[i]<=m[i+7]+Modes.diff || m[i+1]<=m[i+7]+Modes.diff ||
-                 m[i]<=Modes.min_peak_amp || m[i+1]<=Modes.min_peak_amp ||
-                 m[i+2]>=Modes.max_noicefloor_close || m[i+3]>=Modes.max_noicefloor)
-            {
-                goto next_loop;
-            }
+        for (int j = 0; j < CONTROL_PARAMS; j++) {
+            if (cmd->given[j] == false) continue;
+            if (controlParams[j].byte != NULL) *controlParams[j].byte = (uint8_t) cmd->value[j];
+            else if (controlParams[j].ratio != NULL) *controlParams[j].ratio = cmd->value[j];
+            else if (j == PARAM_GAIN) Modes.gain = (int) cmd->value[j];
+            else Modes.enable_agc = (int) cmd->value[j];
+            ratios |= controlParams[j].ratio != NULL;
+            tuner |= j == PARAM_GAIN || j == PARAM_AGC;
+        }
+        if (ratios) populateRatioTables();
+        for (int k = 0; k < Modes.inputs; k++) {
+            struct input *in = &Modes.input[k];
 
-            /* Check existence of valid Mode S preample. If there is P3 pulse 2 microseconds
-            * after start the message is Mode S message. */
-            if (m[i+5] >= m[i+3]+Modes.diff &&
-                m[i+6] >= m[i+3]+Modes.diff &&
-                m[i+5] >= m[i+4]+Modes.diffclose &&
-                m[i+6] >= m[i+4]+Modes.diffclose &&
-                m[i+5] >= m[i+2]+Modes.diffclose &&
-                m[i+6] >= m[i+2]+Modes.diffclose &&
-                m[i+5] >= m[i+7]+Modes.diffclose &&
-                m[i+6] >= m[i+7]+Modes.diffclose &&
-                m[i+5] >= m[i+8]+Modes.diffclose &&
-                m[i+6] >= m[i+8]+Modes.diffclose &&
-                m[i+5] >= Modes.min_peak_amp &&
-                m[i+6] >= Modes.min_peak_amp &&
-                m[i+2] <= Modes.max_noicefloor_close &&
-                m[i+3] <= Modes.max_noicefloor &&
-                m[i+4] <= Modes.max_noicefloor_close &&
-                m[i+7] <= Modes.max_noicefloor_close &&
-                m[i+8] <= Modes.max_noicefloor_close &&
-                (float) m[i+4]/m[i] < Modes.diffratioclose &&
-                (float) m[i+4]/m[i+1] < Modes.diffratioclose &&
-                (float) m[i+7]/m[i] < Modes.diffratioclose &&
-                (float) m[i+7]/m[i+1] < Modes.diffratioclose &&
-                (float) m[i+3]/m[i+5] < Modes.diffratio &&
-                (float) m[i+3]/m[i+6] < Modes.diffratio &&
-                (float) m[i+4]/m[i+5] < Modes.diffratioclose &&
-                (float) m[i+4]/m[i+6] < Modes.diffratioclose &&
-                (float) m[i+2]/m[i+5] < Modes.diffratioclose &&
-                (float) m[i+2]/m[i+6] < Modes.diffratioclose &&
-                (float) m[i+7]/m[i+5] < Modes.diffratioclose &&
-                (float) m[i+7]/m[i+6] < Modes.diffratioclose &&
-                (float) m[i+8]/m[i+5] < Modes.diffratioclose &&
-                (float) m[i+8]/m[i+6] < Modes.diffratioclose )
-            {
-                Modes.type = 3;
-                Modes.countm++;
-                Modes.count_s++;
-                Modes.order[o] = 3;
-                o++;
-                if (Modes.baselinemode == true)
-                {
-                    averagenfclose.push_back(m[i+4]);
-                    averagenfclose.push_back(m[i+2]);
-                    averagenfclose.push_back(m[i+7]);
-                    averagenf.push_back(m[i+3]);
-                    averagepulse.push_back(m[i+5]);
-                    averagepulse.push_back(m[i+6]);
-                    averagepulse.push_back(m[i+1]);
-                    averagepulse.push_back(m[i]);
-                }
-                if (Modes.print_detected == true)
-                {
-                    printf("Mode S message in starting from bit number: %d ", i);
-                    printf(" %d" " %d" " %d" " %d" " %d" " %d" " %d" " %d" " %d\n\n", m[i], m[i+1], m[i+2], m[i+3], m[i+4], m[i+5], m[i+6], m[i+7], m[i+8]);
-                }
-                i += 49;
-                goto next_loop;
-            }
-            /* Checks if Mode A message. Mode A message has 7,2 microseconds
-            * between end of P1 and start of P3. */
-            if (m[i+20]<Modes.min_peak_amp || m[i+21]<Modes.min_peak_amp) { goto mode_c_check; }
-            for (a = 3; a < 19; a++)
-            {
-                if (m[i+a]+Modes.diff>=m[i+20] || m[i+a]/(float) m[i+20] > Modes.diffratio) { goto mode_c_check; }
-                if (m[i+a]+Modes.diff>=m[i+21] || m[i+a]/(float) m[i+21] > Modes.diffratio) { goto mode_c_check; }
-                if (m[i+a]>Modes.max_noicefloor) { goto mode_c_check; }
-            }
-            if (m[i+22]+Modes.diffclose>=m[i+20]   || m[i+22]+Modes.diffclose>=m[i+21] ||
-                m[i+23]+Modes.diff>=m[i+20]        || m[i+23]+Modes.diff>=m[i+21]      ||
-                m[i+24]+Modes.diffclose>=m[i+20]   || m[i+24]+Modes.diffclose>=m[i+21] ||
-                m[i+19]+Modes.diffclose>=m[i+20]   || m[i+19]+Modes.diffclose>=m[i+21] ||
-                m[i+2]+Modes.diffclose>=m[i+20]    || m[i+2]+Modes.diffclose>=m[i+21]  ||
-                m[i+22]>Modes.max_noicefloor_close ||
-                m[i+23]>Modes.max_noicefloor       ||
-                m[i+24]>Modes.max_noicefloor       ||
-                m[i+19]>Modes.max_noicefloor_close ||
-                m[i+20]<Modes.min_peak_amp         ||
-                m[i+21]<Modes.min_peak_amp         ||
-                (float) m[i+2]/m[i+20] > Modes.diffratioclose  ||
-                (float) m[i+2]/m[i+21] > Modes.diffratioclose  ||
-                (float) m[i+22]/m[i+20] > Modes.diffratioclose ||
-                (float) m[i+22]/m[i+21] > Modes.diffratioclose ||
-                (float) m[i+23]/m[i+20] > Modes.diffratio      ||
-                (float) m[i+23]/m[i+21] > Modes.diffratio) { goto mode_c_check; }
-            Modes.type = 1;
-            os = 25;
-            goto p4_check;
-
-        mode_c_check:
-            /* Checks the message is Mode C message. Mode C message has 20,2 microseconds
-            * between end of P1 and P3. */
-            for (c = 3; c < 51; c++) {
-                if (m[i+c]+Modes.diff>m[i+52] || m[i+c]/m[i+52] > Modes.diffratio) { goto next_loop;}
-                if (m[i+c]+Modes.diff>m[i+53] || m[i+c]/m[i+53] > Modes.diffratio) { goto next_loop;}
-                if (m[i+c]>Modes.max_noicefloor) { goto next_loop; }
+            publishThresholds(in);
+            if (tuner) {
+                pthread_mutex_lock(&Modes.device_lock);
+                if (in->dev != NULL) setTunerGain(in);
+                pthread_mutex_unlock(&Modes.device_lock);
             }
-            if (m[i+54]+Modes.diffclose>=m[i+52] || m[i+54]+Modes.diffclose>=m[i+53] ||
-                m[i+55]+Modes.diff>=m[i+52]      || m[i+55]+Modes.diff>=m[i+53]      ||
-                m[i+56]+Modes.diffclose>=m[i+52] || m[i+56]+Modes.diffclose>=m[i+53] ||
-                m[i+2]+Modes.diffclose>=m[i+52]  || m[i+51]+Modes.diffclose>=m[i+53] ||
-                m[i+54]>Modes.max_noicefloor_close ||
-                m[i+55]>Modes.max_noicefloor       ||
-                m[i+56]>Modes.max_noicefloor       ||
-                m[i+51]>Modes.max_noicefloor_close ||
-                m[i+52]<Modes.min_peak_amp         ||
-                m[i+53]<Modes.min_peak_amp         ||
-                (float) m[i+2]/m[i+52] > Modes.diffratioclose ||
-                (float) m[i+2]/m[i+53] > Modes.diffratioclose ||
-                (float) m[i+51]/m[i+52] > Modes.diffratioclose ||
-                (float) m[i+51]/m[i+53] > Modes.diffratioclose ||
-                (float) m[i+54]/m[i+52] > Modes.diffratioclose ||
-                (float) m[i+54]/m[i+53] > Modes.diffratioclose ||
-                (float) m[i+55]/m[i+52] > Modes.diffratio ||
-                (float) m[i+55]/m[i+53] > Modes.diffratio) { goto next_loop; }
-            Modes.type = 2;
-            os = 57;
-        p4_check:
-
-            /* Checks if Mode A or C message has short p4 pulse */
-            if ((float) m[i+os-1]/m[i+os]<Modes.diffratioclosep4 && (float) m[i+os-1]/m[i+os+1]<Modes.diffratioclosep4
-            && (float) m[i+os-2]/m[i+os]<Modes.diffratiop4      && (float) m[i+os-2]/m[i+os+1]<Modes.diffratiop4
-            && (float) m[i+os-3]/m[i+os]<Modes.diffratioclosep4 && (float) m[i+os-3]/m[i+os+1]<Modes.diffratioclosep4
-            && (float) m[i+os+2]/m[i+os]<Modes.diffratioclosep4 && (float) m[i+os+2]/m[i+os+1]<Modes.diffratioclosep4
-            && (float) m[i+os+3]/m[i+os]<Modes.diffratiop4 && (float) m[i+os+3]/m[i+os+1]<Modes.diffratiop4
-            && m[i+os] > Modes.min_peak_amp && m[i+os+1] > Modes.min_peak_amp
-            && m[i+os+2] < Modes.max_noicefloor_close && m[i+os-1] < Modes.max_noicefloor_close
-            && m[i+os-2] < Modes.max_noicefloor && m[i+os-3] < Modes.max_noicefloor_close)
-            {
-                if (Modes.print_detected == true)
-                {
-                    if (os == 25) {
-                        printf("Mode A all-call Message in location: %d: ", i);
-                        for(a = 0; a < os+5; a++) {
-                            printf(" %d", m[i+a]);
-                        }
-                        printf("\n\n");
-                    }
-                    if (os == 57) {
-                        printf("Mode C all-call Message in location: %d: ", i);
-                        for(a = 0; a < os+5; a++) {
-                            printf(" %d", m[i+a]);
-                        }
-                        printf("\n\n");
-                    }
-                }
-                if (os == 25) { Modes.count_a_acac++; Modes.countm++; i += 27; }
-                if (os == 57) { Modes.count_c_acac++; Modes.countm++; i += 59; }
-                Modes.order[o] = 20 + Modes.type; /* 20 --> short p4 */
-                o++;
+        }
+    } else {
+        if (Modes.inputs > 1) {
+            for (int k = 0; k < Modes.inputs; k++) {
+                snprintf(line, sizeof(line), "input%d_", k);
+                controlCounts(cmd->reply, line, k, k);
             }
+        }
+        controlCounts(cmd->reply, "", 0, Modes.inputs - 1);
+        if (cmd->op == CONTROL_RESET) {
+            for (int k = 0; k < Modes.inputs; k++) {
+                struct input *in = &Modes.input[k];
 
-            /* Checks if Mode A or C message has long p4 pulse */
-            else if ( (float) m[i+os-1]/m[i+os] < Modes.diffratioclosep4 && (float) m[i+os-1]/m[i+os+1] < Modes.diffratioclosep4
-                  && (float) m[i+os-1]/m[i+os+2] < Modes.diffratioclosep4 && (float) m[i+os-1]/m[i+os+3] < Modes.diffratioclosep4
-                  && (float) m[i+os-2]/m[i+os] < Modes.diffratiop4 && (float) m[i+os-2]/m[i+os+1] < Modes.diffratiop4
-                  && (float) m[i+os-2]/m[i+os+2] < Modes.diffratiop4 && (float) m[i+os-2]/m[i+os+3] < Modes.diffratiop4
-                  && (float) m[i+os-3]/m[i+os] < Modes.diffratioclosep4 && (float) m[i+os-3]/m[i+os+1] < Modes.diffratioclosep4
-                  && (float) m[i+os-3]/m[i+os+2] < Modes.diffratioclosep4 && (float) m[i+os-3]/m[i+os+3] < Modes.diffratioclosep4
-                  && (float) m[i+os+4]/m[i+os] < Modes.diffratioclosep4 && (float) m[i+os+4]/m[i+os+1] < Modes.diffratioclosep4
-                  && (float) m[i+os+4]/m[i+os+2] < Modes.diffratioclosep4 && (float) m[i+os+4]/m[i+os+3] < Modes.diffratioclosep4
-                  && m[i+os] > Modes.min_peak_amp && m[i+os+1] > Modes.min_peak_amp && m[i+os+2] > Modes.min_peak_amp && m[i+os+3] > Modes.min_peak_amp
-                  && m[i+os-1] < Modes.max_noicefloor_close && m[i+os+4] < Modes.max_noicefloor_close && m[i+os-3] < Modes.max_noicefloor_close
-                  && m[i+os-2] < Modes.max_noicefloor)
-            {
-                if (Modes.print_detected == true)
-                {
-                    if (os == 25) {
-                        printf("Mode A all-call (Compatibility mode) Message starting from bit number: %d ", i);
-                        for(a = 0; a < os+5; a++) {
-                            printf(" %d", m[i+a]);
-                        }
-                        printf("\n\n");
-                    }
-                    if (os == 57) {
-                        printf("Mode C all-call (Compatibility mode) Message starting from bit number: %d ", i);
-                        for(a = 0; a < os+5; a++) {
-                            printf(" %d", m[i+a]);
-                        }
-                        printf("\n\n");
-                    }
-                }
-                if (os == 25) { Modes.count_a_acsac++; Modes.countm++; i += 29; }
-                if (os == 57) { Modes.count_c_acsac++; Modes.countm++; i += 61; }
-                Modes.order[o] = 30 + Modes.type; /* 30 --> long p4 (compatibility mode) */
-                o++;
+                in->cumulative_countm = 0;
+                in->cumulative_count_a = 0;
+                in->cumulative_count_c = 0;
+                in->cumulative_count_a_acac = 0;
+                in->cumulative_count_c_acac = 0;
+                in->cumulative_count_a_acsac = 0;
+                in->cumulative_count_c_acsac = 0;
+                in->cumulative_count_s = 0;
+                in->cumulative_count_s_short = 0;
+                in->cumulative_count_s_long = 0;
             }
+        }
+    }
+    cmd->reply += "ok\n";
+    Modes.control_pending.store(false, std::memory_order_relaxed);
+    pthread_cond_signal(&Modes.control_cond);
+    pthread_mutex_unlock(&Modes.control_mutex);
+}
 
-            /* No p4 pulse */
-            else
-            {
-                if (os == 25) {
-                Modes.count_a++;
-                Modes.countm++;
-                    if (Modes.baselinemode == true)
-                    {
-                        for (a = i+3; a < 19; a++) {
-                            averagenf.push_back(m[a]);
-                        }
-                    averagenfclose.push_back(m[i+19]);
-                    averagenfclose.push_back(m[i+2]);
-                    averagenfclose.push_back(m[i+22]);
-                    averagenf.push_back(m[i+23]);
-                    averagepulse.push_back(m[i]);
-                    averagepulse.push_back(m[i+1]);
-                    averagepulse.push_back(m[i+20]);
-                    averagepulse.push_back(m[i+21]);
-                    }
-                    if (Modes.print_detected == true)
-                    {
-                        printf("Mode A Message starting from bit number: %d ", i);
-                        for(a = 0; a < os+5; a++) {
-                            printf(" %d", m[i+a]);
-                        }
-                        printf("\n\n");
-                    }
-                i += 23;
-                Modes.order[o] = 10 + Modes.type;
-                o++;
-                }
-                if (os == 57)
-                {
-                    Modes.count_c++;
-                    Modes.countm++;
-                    if (Modes.baselinemode == true)
-                    {
-                        for (c = i+3; c < 51; c++) {
-                            averagenf.push_back(m[c]);
-                        }
-                        averagenfclose.push_back(m[i+51]);
-                        averagenfclose.push_back(m[i+2]);
-                        averagenfclose.push_back(m[i+54]);
-                        averagepulse.push_back(m[i+52]);
-                        averagepulse.push_back(m[i+53]);
-                        averagepulse.push_back(m[i]);
-                        averagepulse.push_back(m[i+1]);
-                    }
-
-                    if (Modes.print_detected == true)
-                    {
-                        printf("Mode C Message starting from bit number: %d ", i);
-                        for(a = 0; a < os+5; a++) {
-                            printf(" %d", m[i+a]);
-                        }
-                        printf("\n\n");
-                    }
-                i += 56;
-                Modes.order[o] = 10 + Modes.type; /* 10 --> no p4 */
-                o++;
-                }
-            }
-        next_loop:
-            continue;
+/* Runs one line of the control protocol and returns the reply. The command
+ * waits for the detector to reach a block boundary. */
+static string controlRun(char *line) {
+    struct controlCommand cmd;
+    struct timespec deadline;
+    char *save;
+    char *word = strtok_r(line, " \t", &save);
+    string reply;
+
+    memset(cmd.given, 0, sizeof(cmd.given));
+    if (word == NULL) return "";
+    if (!strcmp(word, "get")) {
+        cmd.op = CONTROL_GET;
+    } else if (!strcmp(word, "set")) {
+        const char *error = controlParseSet(strtok_r(NULL, "", &save), &cmd);
+
+        if (error != NULL) return string("error: ") + error + "\n";
+        cmd.op = CONTROL_SET;
+    } else if (!strcmp(word, "stats")) {
+        cmd.op = CONTROL_STATS;
+    } else if (!strcmp(word, "reset")) {
+        cmd.op = CONTROL_RESET;
+    } else {
+        return "error: unknown command, use get, set, stats or reset\n";
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += MODES_CONTROL_TIMEOUT;
+    pthread_mutex_lock(&Modes.control_mutex);
+    Modes.control.op = cmd.op;
+    memcpy(Modes.control.given, cmd.given, sizeof(cmd.given));
+    memcpy(Modes.control.value, cmd.value, sizeof(cmd.value));
+    Modes.control_pending.store(true, std::memory_order_release);
+    while (Modes.control_pending.load(std::memory_order_relaxed) &&
+        pthread_cond_timedwait(&Modes.control_cond, &Modes.control_mutex, &deadline) != ETIMEDOUT);
+    if (Modes.control_pending.load(std::memory_order_relaxed)) {
+        Modes.control_pending.store(false, std::memory_order_relaxed);
+        reply = "error: no block boundary within " + to_string(MODES_CONTROL_TIMEOUT) + " seconds, nothing changed\n";
+    } else {
+        reply = Modes.control.reply;
+    }
+    pthread_mutex_unlock(&Modes.control_mutex);
+    return reply;
+}
+
+/* Control thread, reads commands a line at a time from one client at a time
+ * and answers each with its result. Clients silent for MODES_CONTROL_IDLE
+ * seconds are dropped. */
+void *controlServer(void *) {
+    struct timeval timeout = { MODES_CONTROL_IDLE, 0 };
+    char buf[MODES_CONTROL_LINE];
+
+    while (1) {
+        int fd = accept(Modes.control_fd, NULL, NULL);
+        string pending;
+        ssize_t n;
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "Control socket stopped: %s\n", strerror(errno));
+            return NULL;
         }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            size_t eol;
 
-        /* Takes averages of each pulse and non pulse type in detected messages and outputs them. */
-        if (Modes.baselinemode == true)
-        {
-            int sum = 0;
-            /* Average of pulse values */
-            if (averagepulse.size() > 2)
-            {
-                for(i = 0; i < averagepulse.size(); i++) {
-                    sum += (int) averagepulse.at(i);
-                }
-                printf("Recommended minimum pulse amplitude (mpa): %d\n",  sum/averagepulse.size());
-            }
-            sum = 0;
-            /* Average of noicefloor not next to pulse values */
-            if (averagenf.size() > 2)
-            {
-                for(i = 0; i < averagenf.size(); i++) {
-                    sum += (int) averagenf.at(i);
-                }
-                printf("Recommended maximum noice floor (mnf): %d\n",  sum/averagenf.size());
+            pending.append(buf, n);
+            while ((eol = pending.find('\n')) != string::npos) {
+                string line = pending.substr(0, eol);
+                string reply;
+
+                pending.erase(0, eol + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                reply = controlRun(&line[0]);
+                /* MSG_NOSIGNAL so a client closing early can't stop the program */
+                send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
             }
-            sum = 0;
-            /* Average of noicefloor next to pulse values */
-            if (averagenfclose.size() > 2)
-            {
-                for(i = 0; i < averagenfclose.size(); i++) {
-                    sum += (int) averagenfclose.at(i);
-                }
-                printf("Recommended minimum close pulse proximity noice floor: %d\n", sum/averagenfclose.size());
+            if (pending.size() >= MODES_CONTROL_LINE) {
+                send(fd, "error: line too long\n", 21, MSG_NOSIGNAL);
+                break;
             }
-            return;
         }
+        close(fd);
     }
+    return NULL;
 }
 
-/* Prints help */
-void showHelp(void) {
-    printf("Commands:\n"
-    "--device           Input rtl-sdr device index\n"
-    "--file             Input location and full name of test file that is used instead of rtl-sdr device\n"
-    "--gain             Input desired gain level for rtl-sdr device\n"
-    "--agc              Enable automatic gain control by RTL-SDR device\n"
-    "--diff             Add minimum amplitude difference between pulses and non pulses that not right next to pulses\n"
-    "--diffclose        Add minimum amplitude difference between pulses and non pulses right next to pulses\n"
-    "--diffratio        Add minimum ratio of non pulse amplitude divided by pulse amplitude for every non pulse value not right next to pulse\n"
-    "--diffratioclose   Add minimum ratio of non pulse amplitude divided by pulse amplitude for every non pulse value right next to pulse\n"
-    "--diffratiop4      Same as diffratio but only for p4 check (Mode a/c only all-call and Mode a/c/s all-call (Compatibility mode) messages)\n"
-    "Compares only p4 pulse values with non pulse values that are after p3 but not next to pulse values.\n"
-    "--diffratioclosep4 Same as diffratio but only for p4 check (Mode a/c only all-call and Mode a/c/s all-call (Compatibility mode) messages)\n"
-    "Compares only p4 pulse values with non pulse values that are after p3 and next to pulse values.\n"
-    "--msgs             Show every recognized messages location and amplitude values in the message\n"
-    "--order            Print order of different SSR interrogation signals\n"
-    "--mpa              Minimum accepted pulse amplitude when there should be a pulse\n"
-    "--mnf              Maximum allowed noicefloor amplitude when there shouldn't be a pulse\n"
-    "--mnfc             Maximum allowed noicefloor amplitude when there shouldn't be a pulse right next to pulse\n"
-    "--size             Defines size of read message when using rtl-sdr. Must be at least 512 otherwise uses default size of 262 144.\n"
-    "--blmode           Outputs baseline values for mpa, mnf and mnfc based on accepted averages.\n"
-    "--print            Print all captured amplitude data.\n"
-    "--continuous       Keeps detecting and reporting messages continuously. Size parameter sets update interval.\n"
-    "--help             Show this help\n");
+/* Opens the --control Unix socket */
+void controlInit(void) {
+    pthread_mutex_init(&Modes.control_mutex, NULL);
+    pthread_cond_init(&Modes.control_cond, NULL);
+    if ((Modes.control_fd = bindUnix(Modes.control_path)) < 0 || listen(Modes.control_fd, 8) < 0) {
+        fprintf(stderr, "Error opening control socket %s: %s\n", Modes.control_path, strerror(errno));
+        exit(1);
+    }
+    pthread_create(&Modes.control_thread, NULL, controlServer, NULL);
 }
 
-/* Turns I/Q data to positive amplitude values with help of magnitude table */
-void computeMagnitudeVector(void) {
-    uint8_t *m = Modes.magnitude;
-    unsigned char *p = Modes.data;
-    uint32_t j;
-    for (j = 0; j < Modes.data_length; j += 2) {
-        int i = p[j]-127;
-        int q = p[j+1]-127;
+/* Prints the runs of message types of the block and empties the order log. */
+void printOrder(void) {
+    static const char *names[MODES_MESSAGE_TYPES] = { "Mode A", "Mode C", "Mode A All-Call", "Mode C All-Call",
+        "Mode A All-Call (Compatibility Mode)", "Mode C All-Call (Compatibility Mode)", "Mode S" };
+    struct orderLog *log = &Modes.order;
 
-        if (i < 0) i = -i;
-        if (q < 0) q = -q;
-        m[j/2] = Modes.maglut[i*129+q];
+    reportPrintf("Sequence of recognized modes in message:\n");
+    for (uint32_t j = 0; j < log->runs; j++) {
+        const struct orderRun *r = &log->run[j];
+
+        if (r->count > 1) {
+            reportPrintf("%u %s messages in a row, samples %llu-%llu\n", r->count, names[messageIndex(r->code)],
+                (unsigned long long) r->first, (unsigned long long) r->last);
+        } else {
+            reportPrintf("%s message, sample %llu\n", names[messageIndex(r->code)], (unsigned long long) r->first);
+        }
+    }
+    if (log->lost > 0) {
+        reportPrintf("%llu later messages not in the sequence, it holds %d runs per block\n", (unsigned long long) log->lost, MODES_ORDER_RUNS);
     }
+    reportPrintf("\n");
+    log->runs = 0;
+    log->lost = 0;
 }
 
-void populateMagnitudeTable(void) {
-    uint8_t i;
-    uint8_t q;
-    /* Fill all possible I/Q values to table which saves time and processing power
-     * since program doesn't have to calculate same squareroots or round numbers
-     *
-     * We multiply it by 1.405 to utilize full resolution (0-255).
-     */
-    Modes.maglut = (uint8_t *) malloc(129*129*2);
-        for (i = 0; i <= 128; i++) {
-            for (q = 0; q <= 128; q++) {
-                Modes.maglut[i*129+q] = round(sqrt(i*i+q*q)*1.405);
-            }
-        }
+/* Prints the cumulative statistics of all inputs together. */
+void printMergedStats(void) {
+    int countm = 0, count_a = 0, count_c = 0, count_a_acac = 0, count_c_acac = 0, count_a_acsac = 0, count_c_acsac = 0, count_s = 0;
+    int count_s_short = 0, count_s_long = 0;
+
+    for (int k = 0; k < Modes.inputs; k++) {
+        const struct input *in = &Modes.input[k];
+
+        countm += in->cumulative_countm;
+        count_a += in->cumulative_count_a;
+        count_c += in->cumulative_count_c;
+        count_a_acac += in->cumulative_count_a_acac;
+        count_c_acac += in->cumulative_count_c_acac;
+        count_a_acsac += in->cumulative_count_a_acsac;
+        count_c_acsac += in->cumulative_count_c_acsac;
+        count_s += in->cumulative_count_s;
+        count_s_short += in->cumulative_count_s_short;
+        count_s_long += in->cumulative_count_s_long;
     }
+    reportPrintf("Merged statistics of all %d inputs so far:\n"
+    "Mode messages recognized in total:                          %d\n"
+    "Mode A messages recognized:                                 %d\n"
+    "Mode C messages recognized:                                 %d\n"
+    "Mode A All-Call messages recognized:                        %d\n"
+    "Mode C All-Call messages recognized:                        %d\n"
+    "Mode A All-Call (Compatibility Mode) messages recognized:    %d\n"
+    "Mode C All-Call (Compatibility Mode) messages recognized:   %d\n"
+    "Mode S messages recognized:                                 %d\n"
+    "Mode S 56 bit/112 bit/unmeasured uplinks:                   %d/%d/%d\n\n", Modes.inputs, countm, count_a, count_c,
+                                                                   count_a_acac, count_c_acac, count_a_acsac,
+                                                                   count_c_acsac, count_s, count_s_short, count_s_long,
+                                                                   count_s - count_s_short - count_s_long);
+}
 
-/* Prints statistics of different detected message types. */
+/* Prints statistics of different detected message types of the input of the
+ * block. With several inputs they start with the name of the input. */
 void printStats(void) {
-    int i;
-    int j;
-    int consecutive;
-    if (Modes.countm == 0)
+    bool streaming = Modes.continuous == true || Modes.filename != NULL; /* Several blocks, keep cumulative statistics */
+    if (Modes.in->countm == 0)
     {
-        if (Modes.continuous == false)
+        if (streaming == false)
+        {
+            if (Modes.inputs > 1) reportPrintf("Input %d, %s: ", Modes.in->index, Modes.in->name);
+            reportPrintf("No messages detected.");
+        }
+        else if (Modes.in->ring.dropped.load(std::memory_order_relaxed) != Modes.in->reported_drops)
         {
-            printf("No messages detected.");
+            if (Modes.inputs > 1) reportPrintf("Input %d, %s:\n", Modes.in->index, Modes.in->name);
+            printRingStats();
         }
     }
 
     else
     {
-        printf("Statistics of measured data with length of %d bits:\n"
+        if (Modes.inputs > 1) reportPrintf("Input %d, %s:\n", Modes.in->index, Modes.in->name);
+        reportPrintf("Statistics of measured data with length of %d bits:\n"
         "Messages recognized in total:                          %d\n"
         "Mode A messages recognized:                                 %d\n"
         "Mode C messages recognized:                                 %d\n"
@@ -621,20 +3272,24 @@ void printStats(void) {
         "Mode C All-Call messages recognized:                        %d\n"
         "Mode A All-Call (Compatibility Mode) messages recognized:    %d\n"
         "Mode C All-Call (Compatibility Mode) messages recognized:   %d\n"
-        "Mode S messages recognized:                                 %d\n\n", Modes.data_length, Modes.countm, Modes.count_a, Modes.count_c,
-                                                                           Modes.count_a_acac, Modes.count_c_acac, Modes.count_a_acsac,
-                                                                           Modes.count_c_acsac, Modes.count_s);
-        if (Modes.continuous == true)
+        "Mode S messages recognized:                                 %d\n"
+        "Mode S 56 bit/112 bit/unmeasured uplinks:                   %d/%d/%d\n\n", Modes.in->block_length, Modes.in->countm, Modes.in->count_a, Modes.in->count_c,
+                                                                           Modes.in->count_a_acac, Modes.in->count_c_acac, Modes.in->count_a_acsac,
+                                                                           Modes.in->count_c_acsac, Modes.in->count_s, Modes.in->count_s_short, Modes.in->count_s_long,
+                                                                           Modes.in->count_s - Modes.in->count_s_short - Modes.in->count_s_long);
+        if (streaming == true)
         {
-            Modes.cumulative_countm += Modes.countm;
-            Modes.cumulative_count_a += Modes.count_a;
-            Modes.cumulative_count_c += Modes.count_c;
-            Modes.cumulative_count_a_acac += Modes.count_a_acac;
-            Modes.cumulative_count_c_acac += Modes.count_c_acac;
-            Modes.cumulative_count_a_acsac += Modes.count_a_acsac;
-            Modes.cumulative_count_c_acsac += Modes.count_c_acsac;
-            Modes.cumulative_count_s += Modes.count_s;
-            printf("Cumulative statistics so far:\n"
+            Modes.in->cumulative_countm += Modes.in->countm;
+            Modes.in->cumulative_count_a += Modes.in->count_a;
+            Modes.in->cumulative_count_c += Modes.in->count_c;
+            Modes.in->cumulative_count_a_acac += Modes.in->count_a_acac;
+            Modes.in->cumulative_count_c_acac += Modes.in->count_c_acac;
+            Modes.in->cumulative_count_a_acsac += Modes.in->count_a_acsac;
+            Modes.in->cumulative_count_c_acsac += Modes.in->count_c_acsac;
+            Modes.in->cumulative_count_s += Modes.in->count_s;
+            Modes.in->cumulative_count_s_short += Modes.in->count_s_short;
+            Modes.in->cumulative_count_s_long += Modes.in->count_s_long;
+            reportPrintf("Cumulative statistics so far:\n"
             "Mode messages recognized in total:                          %d\n"
             "Mode A messages recognized:                                 %d\n"
             "Mode C messages recognized:                                 %d\n"
@@ -642,174 +3297,347 @@ void printStats(void) {
             "Mode C All-Call messages recognized:                        %d\n"
             "Mode A All-Call (Compatibility Mode) messages recognized:    %d\n"
             "Mode C All-Call (Compatibility Mode) messages recognized:   %d\n"
-            "Mode S messages recognized:                                 %d\n\n", Modes.cumulative_countm, Modes.cumulative_count_a, Modes.cumulative_count_c,
-                                                                           Modes.cumulative_count_a_acac, Modes.cumulative_count_c_acac, Modes.cumulative_count_a_acsac,
-                                                                           Modes.cumulative_count_c_acsac, Modes.cumulative_count_s);
-        }
-        Modes.countm = 0;
-        Modes.count_a = 0;
-        Modes.count_c = 0;
-        Modes.count_a_acac = 0;
-        Modes.count_c_acac = 0;
-        Modes.count_a_acsac = 0;
-        Modes.count_c_acsac = 0;
-        Modes.count_s = 0;
-    }
-
-    /* Prints the order of received messages. Prints message type based on order number given in detectMode function.
-    * Counts consecutive messages, prints the amount instead of printing them separately. */
-    if (Modes.order[0] != 0 && Modes.print_order == true && Modes.continuous == false) {
-        printf("Sequence of recognized modes in message:\n");
-        for (i = 0; i < Modes.countm; i++) {
-            if (Modes.order[i] == 32) {
-                if (Modes.order[i+1] == 32) {
-                    consecutive = 2;
-                    for (j = i+2; j < Modes.countm; j++) {
-                        if (Modes.order[j] == 32) { consecutive++; }
-                        else { break; }
-                    }
-                    printf("%d Mode C All-Call (Compatibility Mode) messages in a row\n", consecutive);
-                    i = j-1;
-                }
-                else { printf("Mode C All-Call (Compatibility Mode)\n"); }
-            }
-            else if (Modes.order[i] == 22) {
-                if (Modes.order[i+1] == 22) {
-                    consecutive = 2;
-                    for (j = i+2; j < Modes.countm; j++) {
-                        if (Modes.order[j] == 22) { consecutive++; }
-                        else { break; }
-                    }
-                    printf("%d Mode C All-Call messages in a row\n", consecutive);
-                    i = j-1;
-                }
-                else { printf("Mode C All-Call message\n"); }
-            }
-            else if (Modes.order[i] == 21) {
-                if (Modes.order[i+1] == 21) {
-                    consecutive = 2;
-                    for (j = i+2; j < Modes.countm; j++) {
-                        if (Modes.order[j] == 21) { consecutive++; }
-                        else { break; }
-                    }
-                    printf("%d Mode A All-Call messages in a row\n", consecutive);
-                    i = j-1;
-                }
-                else { printf("Mode A All-Call message\n"); }
-            }
-            else if (Modes.order[i] == 11) {
-                if (Modes.order[i+1] == 11) {
-                    consecutive = 2;
-                    for (j = i+2; j < Modes.countm; j++) {
-                        if (Modes.order[j] == 11) { consecutive++; }
-                        else { break; }
-                    }
-                    printf("%d Mode A messages in a row\n", consecutive);
-                    i = j-1;
-                }
-                else { printf("Mode A message\n"); }
-            }
-            else if (Modes.order[i] == 12) {
-                if (Modes.order[i+1] == 12) {
-                    consecutive = 2;
-                    for (j = i+2; j < Modes.countm; j++) {
-                        if (Modes.order[j] == 12) { consecutive++; }
-                        else { break; }
-                    }
-                    printf("%d Mode C messages in a row\n", consecutive);
-                    i = j-1;
-                }
-                else { printf("Mode C message\n"); }
-            }
-            else if (Modes.order[i] == 31) {
-                if (Modes.order[i+1] == 31) {
-                    consecutive = 2;
-                    for (j = i+2; j < Modes.countm; j++) {
-                        if (Modes.order[j] == 31) { consecutive++; }
-                        else { break; }
-                    }
-                    printf("%d Mode A All-Call (Compatibility Mode) messages in a row\n", consecutive);
-                    i = j-1;
-                }
-                else { printf("Mode A All-Call (Compatibility Mode) message\n"); }
-            }
-            else if (Modes.order[i] == 3) {
-                if (Modes.order[i+1] == 3) {
-                    consecutive = 2;
-                    for (j = i+2; j < Modes.countm; j++) {
-                        if (Modes.order[j] == 3) { consecutive++; }
-                        else { break; }
-                    }
-                    printf("%d Mode S messages in a row\n", consecutive);
-                    i = j-1;
-                }
-                else { printf("Mode S message\n"); }
+            "Mode S messages recognized:                                 %d\n"
+            "Mode S 56 bit/112 bit/unmeasured uplinks:                   %d/%d/%d\n\n", Modes.in->cumulative_countm, Modes.in->cumulative_count_a, Modes.in->cumulative_count_c,
+                                                                           Modes.in->cumulative_count_a_acac, Modes.in->cumulative_count_c_acac, Modes.in->cumulative_count_a_acsac,
+                                                                           Modes.in->cumulative_count_c_acsac, Modes.in->cumulative_count_s,
+                                                                           Modes.in->cumulative_count_s_short, Modes.in->cumulative_count_s_long,
+                                                                           Modes.in->cumulative_count_s - Modes.in->cumulative_count_s_short - Modes.in->cumulative_count_s_long);
+            if (Modes.adaptive == true)
+            {
+                reportPrintf("Adaptive thresholds for next block: mpa %d, mnf %d, mnfc %d\n\n", Modes.min_peak_amp, Modes.max_noicefloor, Modes.max_noicefloor_close);
             }
+            if (Modes.inputs > 1) printMergedStats();
+            printRingStats();
         }
+        if (Modes.print_order == true) printOrder();
+        Modes.in->countm = 0;
+        Modes.in->count_a = 0;
+        Modes.in->count_c = 0;
+        Modes.in->count_a_acac = 0;
+        Modes.in->count_c_acac = 0;
+        Modes.in->count_a_acsac = 0;
+        Modes.in->count_c_acsac = 0;
+        Modes.in->count_s = 0;
+        Modes.in->count_s_short = 0;
+        Modes.in->count_s_long = 0;
     }
 }
 
-/* Reads data from file */
-void readDataFromFile(void) {
+/* Reads data from a file, FIFO or standard input one window at a time. Fast
+ * replay waits for the detector instead of dropping windows when the ring is
+ * full. Paced replay hands each window over when its last sample would have
+ * come from the device and drops windows like the rtl-sdr callback. */
+void readDataFromFile(struct input *in) {
 
         ssize_t nread, toread;
-
-        Modes.fd = open(Modes.filename, O_RDONLY);
         unsigned char *p;
-        toread = Modes.data_length;
-        p = Modes.data;
-        while(toread) {
-            nread = read(Modes.fd, p, toread);
-            if (nread <= 0) {
-                break;
+        unsigned char *window = NULL;
+        uint64_t samples = 0;
+
+        if (Modes.paced && (window = (unsigned char *) malloc(Modes.data_length)) == NULL) {
+            printf("Out of memory allocating data buffer.\n");
+            exit(1);
+        }
+        while (Modes.exit == 0) {
+            unsigned char *slot = Modes.paced ? window : ringReserveWait(&in->ring);
+
+            toread = Modes.data_length;
+            p = slot;
+            while(toread) {
+                nread = read(in->fd, p, toread);
+                if (nread < 0 && errno == EINTR && Modes.exit == 0) continue;
+                if (nread <= 0) {
+                    break;
+                }
+                p += nread;
+                toread -= nread;
             }
-            p += nread;
-            toread -= nread;
+            if (toread == Modes.data_length) break;
+            if (Modes.paced) {
+                struct timespec due = in->replay_start;
+
+                samples += (Modes.data_length - toread) / Modes.pair_bytes;
+                due.tv_sec += samples / Modes.samplerate;
+                due.tv_nsec += (long) ((samples % Modes.samplerate) * 1000000000ULL / Modes.samplerate);
+                if (due.tv_nsec >= 1000000000L) {
+                    due.tv_sec++;
+                    due.tv_nsec -= 1000000000L;
+                }
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR && Modes.exit == 0);
+                PROFILE_RING_STAMP(&in->ring, Modes.profile ? profileNow() : 0);
+                ringPush(&in->ring, window, Modes.data_length - toread);
+            } else {
+                PROFILE_RING_STAMP(&in->ring, Modes.profile ? profileNow() : 0);
+                ringCommit(&in->ring, Modes.data_length - toread);
+            }
+            if (toread) break;
         }
-        Modes.data_ready = 1;
-        pthread_cond_signal(&Modes.data_cond);
-        pthread_mutex_unlock(&Modes.data_mutex);
+        free(window);
+        close(in->fd);
+        ringClose(&in->ring);
     }
 
 void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx) {
+    struct input *in = (struct input *) ctx;
+
+    PROFILE_RING_STAMP(&in->ring, Modes.profile ? profileNow() : 0);
 
-    /* Read the new data. */
-    memcpy(Modes.data, buf, Modes.data_length);
-    pthread_cond_signal(&Modes.data_cond);
-    pthread_mutex_unlock(&Modes.data_mutex);
+    if (Modes.exit) {
+        rtlsdr_cancel_async(in->dev);
+        return;
+    }
+
+    /* Single capture uses the first block, the device can deliver a few more before stopping. */
+    if (Modes.continuous == false && in->ring.enqueued.load(std::memory_order_relaxed) != 0) return;
+
+    /* Queue the new data. Never waits for the magnitude stage or the disk, a full ring is counted as dropped. */
+    if (Modes.record_fd >= 0 && ringPush(&Modes.record_ring, buf, len) == false) {
+        Modes.record_dropped.fetch_add(len, std::memory_order_relaxed);
+    }
+    ringPush(&in->ring, buf, len);
     if (Modes.continuous == false)
     {
-        rtlsdr_cancel_async(Modes.dev);
+        rtlsdr_cancel_async(in->dev);
     }
-    Modes.data_ready = true;
 }
 
+/* Reader stage of an input */
 void *dataReader(void *arg) {
-    if (Modes.filename == NULL) {
-        modesInitRTLSDR();
+    struct input *in = (struct input *) arg;
+    struct timespec ts;
 
-        rtlsdr_read_async(Modes.dev, rtlsdrCallback, NULL,
+    setStageAffinity(STAGE_READER);
+    if (in->filename == NULL) {
+        modesInitRTLSDR(in);
+    }
+
+    /* Event times count from here, detector sees this through the rings */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    in->capture_start_us = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    clock_gettime(CLOCK_MONOTONIC, &in->replay_start);
+    if (in->filename == NULL) {
+        rtlsdr_read_async(in->dev, rtlsdrCallback, in,
                               MODES_ASYNC_BUF_NUMBER,
                               Modes.data_length);
+        ringClose(&in->ring);
+        if (Modes.record_fd >= 0) ringClose(&Modes.record_ring);
 
     } else {
-        readDataFromFile();
+        readDataFromFile(in);
+    }
+    return NULL;
+}
+
+/* Magnitude stage, converts capture blocks to magnitude blocks of one magnitude
+ * per I/Q pair, which is the length of the magnitude block. Magnitudes are
+ * written after the last MODES_PATTERN_LEN magnitudes of the previous block,
+ * followed by the candidate mask of the whole slot, see computeFrontEnd. Waits
+ * when the detector falls behind, which shows up as dropped capture blocks at
+ * the reader like before. */
+void *magnitudeStage(void *arg) {
+    struct input *in = (struct input *) arg;
+    unsigned char *block;
+    uint32_t len;
+
+    setStageAffinity(STAGE_MAGNITUDE);
+    while ((block = ringWait(&in->ring, &len)) != NULL) {
+        unsigned char *slot = ringReserveWait(&in->mag_ring);
+        PROFILE_NOW(started);
+
+        uint32_t pairs = len / Modes.pair_bytes;
+        uint32_t thresholds = in->thresholds.load(std::memory_order_relaxed);
+
+        /* Dropped capture blocks are handed on as samples, the tail isn't next to this block */
+        in->mag_ring.lost = ringGap(&in->ring) / Modes.pair_bytes;
+        if (in->mag_ring.lost != 0) memset(in->tail, 0, sizeof(in->tail));
+        memcpy(slot, in->tail, MODES_PATTERN_LEN);
+        computeFrontEnd(block, pairs, slot, slotCandidates(slot), thresholds);
+        *slotThresholds(slot) = thresholds;
+        memcpy(in->tail, slot + pairs, MODES_PATTERN_LEN);
+#ifdef MODES_PROFILE
+        if (Modes.profile) {
+            uint64_t done = profileNow();
+
+            PROFILE_ADD(PROF_MAGNITUDE, done - started);
+            PROFILE_ADD(PROF_TO_MAGNITUDE, done - ringStamp(&in->ring));
+            PROFILE_RING_STAMP(&in->mag_ring, ringStamp(&in->ring));
+        }
+#endif
+        ringRelease(&in->ring);
+        ringCommit(&in->mag_ring, pairs);
+    }
+    ringClose(&in->mag_ring);
+    return NULL;
+}
+
+/* Event writer stage, writes event records to the --events file or FIFO a ring
+ * slot at a time. After a write error the rest of the events are discarded. */
+void *eventWriterStage(void *) {
+    unsigned char *chunk;
+    uint32_t len;
+    bool failed = false;
+
+    setStageAffinity(STAGE_EVENTS);
+    while ((chunk = ringWait(&Modes.event_ring, &len)) != NULL) {
+        uint32_t done = 0;
+
+        while (failed == false && done < len) {
+            ssize_t n = write(Modes.events_fd, chunk + done, len - done);
+
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fprintf(stderr, "Error writing events to %s: %s\n", Modes.events_name, strerror(errno));
+                failed = true;
+                break;
+            }
+            done += n;
+        }
+        PROFILE_ADD(PROF_TO_EVENTS, profileNow() - ringStamp(&Modes.event_ring));
+        ringRelease(&Modes.event_ring);
+    }
+    return NULL;
+}
+
+/* Recorder stage, writes the raw I/Q blocks of the rtl-sdr callback as they came,
+ * so the capture can be run again with --file. Only this thread waits for the
+ * disk. Written data is flushed out of the page cache every MODES_RECORD_SYNC
+ * bytes so a long recording doesn't push everything else out of memory. Files
+ * are rotated at block boundaries. After a write error the rest is counted as
+ * dropped. */
+void *recordWriterStage(void *) {
+    unsigned char *block;
+    uint32_t len;
+    uint64_t in_file = 0;           /* Bytes in the current file */
+    uint64_t synced = 0;            /* Bytes of the current file already flushed */
+    int index = 0;
+    bool failed = false;
+
+    setStageAffinity(STAGE_RECORD);
+    while ((block = ringWait(&Modes.record_ring, &len)) != NULL) {
+        uint32_t done = 0;
+
+        if (failed == false && Modes.record_limit > 0 && in_file > 0 && in_file + len > Modes.record_limit) {
+            close(Modes.record_fd);
+            if ((Modes.record_fd = recordOpen(++index)) < 0) failed = true;
+            in_file = 0;
+            synced = 0;
+        }
+        while (failed == false && done < len) {
+            ssize_t n = write(Modes.record_fd, block + done, len - done);
+
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fprintf(stderr, "Error recording to %s: %s\n", Modes.record_name, strerror(errno));
+                failed = true;
+                break;
+            }
+            done += n;
+        }
+        in_file += done;
+        Modes.record_written.fetch_add(done, std::memory_order_relaxed);
+        if (done < len) Modes.record_dropped.fetch_add(len - done, std::memory_order_relaxed);
+        if (failed == false && in_file - synced >= MODES_RECORD_SYNC) {
+            fdatasync(Modes.record_fd);
+            posix_fadvise(Modes.record_fd, synced, in_file - synced, POSIX_FADV_DONTNEED);
+            synced = in_file;
+        }
+        ringRelease(&Modes.record_ring);
+    }
+    return NULL;
+}
+
+/* Reporter stage, writes the output text of the detector. Only this stage waits
+ * for a slow terminal, pipe or file. */
+void *reporterStage(void *) {
+    unsigned char *chunk;
+    uint32_t len;
+
+    setStageAffinity(STAGE_REPORTER);
+    while ((chunk = ringWait(&Modes.report_ring, &len)) != NULL) {
+        PROFILE_NOW(started);
+
+        fwrite(chunk, 1, len, stdout);
+        fflush(stdout);
+#ifdef MODES_PROFILE
+        if (Modes.profile) {
+            uint64_t done = profileNow();
+
+            PROFILE_ADD(PROF_WRITE, done - started);
+            PROFILE_ADD(PROF_TO_WRITTEN, done - ringStamp(&Modes.report_ring));
+        }
+#endif
+        ringRelease(&Modes.report_ring);
     }
     return NULL;
 }
 
 
+#ifndef DUMP1030_NO_MAIN /* kernelbench.cpp includes this file for the kernels */
+/* Stops capture, the blocks already read are still processed. A second signal
+ * ends the program right away. */
+static void exitSignal(int sig) {
+    signal(sig, SIG_DFL);
+    Modes.exit = 1;
+}
+
+/* Returns the next magnitude block for the detector and makes its input
+ * Modes.in. Inputs take turns a block at a time. Live inputs with nothing
+ * queued are skipped so a stalled device doesn't hold up the others, while
+ * lossless replay waits for the input whose turn it is so files give the same
+ * output every run. Returns NULL once every input is closed and drained. */
+unsigned char *nextInput(uint32_t *len) {
+    bool stalled = false;
+
+    while (true) {
+        int open = 0;
+
+        for (int k = 0; k < Modes.inputs; k++) {
+            struct input *in = &Modes.input[(Modes.next_input + k) % Modes.inputs];
+            bool closed;
+            unsigned char *block;
+
+            if (in->done) continue;
+            closed = in->mag_ring.closed.load(std::memory_order_acquire);
+            if ((block = ringPeek(&in->mag_ring, len)) != NULL) {
+                Modes.in = in;
+                Modes.next_input = (in->index + 1) % Modes.inputs;
+                return block;
+            }
+            if (closed) {
+                in->done = true;
+                continue;
+            }
+            if (stalled == false) in->mag_ring.empty_stalls.fetch_add(1, std::memory_order_relaxed);
+            open++;
+            if (Modes.lossless) break;
+        }
+        if (open == 0) return NULL;
+        stalled = true;
+        usleep(MODES_RING_POLL_US);
+    }
+}
+
 int main(int argc, char **argv) {
     int i;
+    bool devices = false;
 
     modesInit();
-    populateMagnitudeTable();
-
 
     /* Read commandline options */
     for (i = 1; i < argc; i++) {
         if (!strcmp(argv[i],"--device")) {
-            Modes.dev_index = atoi(argv[++i]);
+            char *p = argv[++i];
+
+            while (*p) {
+                addInput(NULL, strtol(p, &p, 10));
+                if (*p == ',') p++;
+                else if (*p) {
+                    printf("--device takes device indexes separated by commas, for example 0,1,2\n");
+                    exit(1);
+                }
+            }
+            devices = true;
         } else if (!strcmp(argv[i],"--dl")) {
             Modes.downlink = false;
             Modes.freq = 1090000000;
@@ -822,8 +3650,11 @@ int main(int argc, char **argv) {
                 Modes.data_length = atof(argv[i]);
                 Modes.data_length -= Modes.data_length%16384;
             }
+        } else if (!strcmp(argv[i],"--rate")) {
+            Modes.samplerate = atoi(argv[++i]);
         } else if (!strcmp(argv[i],"--file")) {
-            Modes.filename = strdup(argv[++i]);
+            addInput(strdup(argv[++i]), 0);
+            if (Modes.filename == NULL) Modes.filename = Modes.input[Modes.inputs-1].filename;
         } else if (!strcmp(argv[i],"--agc")) {
             Modes.enable_agc = 1;
         } else if (!strcmp(argv[i],"--diff")) {
@@ -840,6 +3671,27 @@ int main(int argc, char **argv) {
             Modes.diffratioclosep4 = atof(argv[++i]);
         } else if (!strcmp(argv[i],"--blmode")) {
             Modes.baselinemode = true;
+        } else if (!strcmp(argv[i],"--adaptive")) {
+            Modes.adaptive = true;
+        } else if (!strcmp(argv[i],"--blpercentiles")) {
+            char *p = argv[++i];
+            Modes.bl_percentiles = 0;
+            while (Modes.bl_percentiles < MODES_BASELINE_PERCENTILES && *p) {
+                float v = strtod(p, &p);
+                int j = Modes.bl_percentiles++;
+
+                if (v < 0) v = 0;
+                if (v > 100) v = 100;
+                /* Kept sorted so the first is the lowest */
+                for (; j > 0 && Modes.bl_percentile[j-1] > v; j--) Modes.bl_percentile[j] = Modes.bl_percentile[j-1];
+                Modes.bl_percentile[j] = v;
+                if (*p == ',') p++;
+                else break;
+            }
+            if (Modes.bl_percentiles == 0) {
+                Modes.bl_percentile[0] = 50;
+                Modes.bl_percentiles = 1;
+            }
         } else if (!strcmp(argv[i],"--order")) {
             Modes.print_order = true;
         } else if (!strcmp(argv[i],"--msgs")) {
@@ -854,6 +3706,79 @@ int main(int argc, char **argv) {
             Modes.print_all = true;
         } else if (!strcmp(argv[i],"--continuous")) {
             Modes.continuous = true;
+        } else if (!strcmp(argv[i],"--threads")) {
+            Modes.threads = atoi(argv[++i]);
+            if (Modes.threads < 1) Modes.threads = 1;
+        } else if (!strcmp(argv[i],"--affinity")) {
+            /* CPUs of reader, magnitude, detector and reporter stages, -1 leaves a stage unpinned */
+            char *p = argv[++i];
+            for (int j = 0; j < STAGE_COUNT && *p; j++) {
+                Modes.affinity[j] = strtol(p, &p, 10);
+                if (*p == ',') p++;
+            }
+        } else if (!strcmp(argv[i],"--stats")) {
+            Modes.stats_interval = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--profile")) {
+#ifdef MODES_PROFILE
+            Modes.profile = true;
+#else
+            printf("--profile needs a build with profiling, make PROFILE=1\n");
+            exit(1);
+#endif
+        } else if (!strcmp(argv[i],"--metrics")) {
+            Modes.metrics_addr = strdup(argv[++i]);
+        } else if (!strcmp(argv[i],"--control")) {
+            Modes.control_path = strdup(argv[++i]);
+        } else if (!strcmp(argv[i],"--events")) {
+            Modes.events_name = strdup(argv[++i]);
+        } else if (!strcmp(argv[i],"--events-format")) {
+            i++;
+            if (!strcmp(argv[i],"json")) {
+                Modes.events_format = EVENTS_JSON;
+            } else if (!strcmp(argv[i],"binary")) {
+                Modes.events_format = EVENTS_BINARY;
+            } else {
+                printf("Unknown event format %s, use json or binary\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i],"--record")) {
+            Modes.record_name = strdup(argv[++i]);
+        } else if (!strcmp(argv[i],"--record-size")) {
+            Modes.record_size = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--record-seconds")) {
+            Modes.record_seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--format")) {
+            static const char *formats[] = { "cu8", "cs8", "cs16", "cf32" };
+            static const uint32_t bytes[] = { 2, 2, 4, 8 };
+
+            i++;
+            Modes.format = -1;
+            for (int j = 0; j < 4; j++) {
+                if (!strcmp(argv[i], formats[j])) {
+                    Modes.format = j;
+                    Modes.pair_bytes = bytes[j];
+                }
+            }
+            if (Modes.format < 0) {
+                printf("Unknown sample format %s, use cu8, cs8, cs16 or cf32\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i],"--scale")) {
+            Modes.scale = atof(argv[++i]);
+            if (!(Modes.scale > 0)) {
+                printf("--scale has to be above zero\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i],"--replay")) {
+            i++;
+            if (!strcmp(argv[i],"fast")) {
+                Modes.paced = false;
+            } else if (!strcmp(argv[i],"paced")) {
+                Modes.paced = true;
+            } else {
+                printf("Unknown replay mode %s, use fast or paced\n", argv[i]);
+                exit(1);
+            }
         } else if (!strcmp(argv[i],"--help")) {
             showHelp();
             exit(1);
@@ -865,45 +3790,200 @@ int main(int argc, char **argv) {
         }
     }
 
+    populateRatioTables();
+    if (!selectDetector(Modes.samplerate)) {
+        fprintf(stderr, "Sample rate %d is not supported, use 2000000, 2400000, 2500000 or 3200000.\n", Modes.samplerate);
+        exit(1);
+    }
+    if (devices && Modes.filename != NULL) {
+        fprintf(stderr, "--device and --file can't be used together.\n");
+        exit(1);
+    }
+    if (Modes.inputs == 0) addInput(NULL, 0);
+    for (int k = 0; k < Modes.inputs; k++) {
+        Modes.input[k].traffic.interval = Modes.stats_interval * Modes.samplerate > 1 ? (uint64_t) (Modes.stats_interval * Modes.samplerate) : 1;
+        Modes.input[k].traffic.next_report = Modes.input[k].traffic.interval;
+        /* Adaptive thresholds start from the given ones on every input */
+        Modes.input[k].adapt.mpa = Modes.min_peak_amp;
+        Modes.input[k].adapt.mnf = Modes.max_noicefloor;
+        Modes.input[k].adapt.mnfc = Modes.max_noicefloor_close;
+        publishThresholds(&Modes.input[k]);
+    }
+    if (Modes.paced && Modes.filename == NULL) {
+        fprintf(stderr, "--replay paced needs --file.\n");
+        exit(1);
+    }
+    Modes.lossless = Modes.filename != NULL && Modes.paced == false;
+    if (Modes.format != FORMAT_CU8 && Modes.filename == NULL) {
+        fprintf(stderr, "rtl-sdr devices give cu8 samples, --format is for --file.\n");
+        exit(1);
+    }
+    /* Full scale of every format gives the same magnitudes as full scale cu8 */
+    static const double full_scale[] = { 128, 128, 32768, 1 };
+    Modes.mag_scale = MODES_MAG_SCALE * Modes.scale * 128 / full_scale[Modes.format];
+    populateMagnitudeTable();
+    if (Modes.record_name != NULL && Modes.filename != NULL) {
+        fprintf(stderr, "--record records rtl-sdr input and can't be used with --file.\n");
+        exit(1);
+    }
+    if (Modes.record_name != NULL && Modes.inputs > 1) {
+        fprintf(stderr, "--record records a single rtl-sdr device.\n");
+        exit(1);
+    }
+    /* Rotate at whichever limit comes first, in whole I/Q pairs */
+    if (Modes.record_size > 0) Modes.record_limit = (uint64_t) (Modes.record_size * 1048576) & ~(uint64_t) 1;
+    if (Modes.record_seconds > 0) {
+        uint64_t bytes = (uint64_t) (Modes.record_seconds * Modes.samplerate) * 2;
+
+        if (Modes.record_limit == 0 || bytes < Modes.record_limit) Modes.record_limit = bytes;
+    }
     dataInit();
+    if (Modes.metrics_addr != NULL) metricsInit();
+    if (Modes.control_path != NULL) controlInit();
+    if (Modes.threads > 1) detectorPoolInit();
 
-    pthread_create(&Modes.reader_thread, NULL, dataReader, NULL);
+    signal(SIGINT, exitSignal);
+    signal(SIGTERM, exitSignal);
+#ifdef MODES_PROFILE
+    if (Modes.profile) signal(SIGUSR1, profileSignal);
+#endif
+    for (int k = 0; k < Modes.inputs; k++) {
+        pthread_create(&Modes.input[k].reader_thread, NULL, dataReader, &Modes.input[k]);
+        pthread_create(&Modes.input[k].magnitude_thread, NULL, magnitudeStage, &Modes.input[k]);
+    }
+    pthread_create(&Modes.reporter_thread, NULL, reporterStage, NULL);
+    if (Modes.events_fd >= 0) pthread_create(&Modes.events_thread, NULL, eventWriterStage, NULL);
+    if (Modes.record_fd >= 0) pthread_create(&Modes.record_thread, NULL, recordWriterStage, NULL);
+    setStageAffinity(STAGE_DETECTOR);
 
-    pthread_mutex_lock(&Modes.data_mutex);
-    if (Modes.continuous == true)
-    {
-        while(1) {
-            if (Modes.data_ready == false) {
-                pthread_cond_wait(&Modes.data_cond,&Modes.data_mutex);
-                continue;
-            }
+    /* Detector stage. Test files are processed window by window until the end of
+     * file, rtl-sdr captures once or until stopped in continuous mode. */
+    unsigned char *block;
+    uint32_t len;
+    while ((block = nextInput(&len)) != NULL) {
+        uint8_t *m = block;
+        uint32_t mlen = MODES_PATTERN_LEN + len;
+        uint64_t gap = ringGap(&Modes.in->mag_ring);
+
+        if (gap != 0) skipGap(gap);
+        int start = Modes.in->scan_start;
+        int first = start < MODES_PATTERN_LEN ? start : MODES_PATTERN_LEN;
+        struct timespec started;
+
+        if (Modes.metrics_fd >= 0) clock_gettime(CLOCK_MONOTONIC, &started);
+#ifdef MODES_PROFILE
+        uint64_t captured = Modes.profile ? ringStamp(&Modes.in->mag_ring) : 0;
+        uint64_t detect_start = Modes.profile ? profileNow() : 0;
+
+        PROFILE_RING_STAMP(&Modes.report_ring, captured);
+        PROFILE_RING_STAMP(&Modes.event_ring, captured);
+#endif
+
+        if (Modes.control_fd >= 0 && Modes.control_pending.load(std::memory_order_acquire)) controlApply();
+        if (Modes.adaptive == true) {
+            Modes.min_peak_amp = Modes.in->adapt.mpa;
+            Modes.max_noicefloor = Modes.in->adapt.mnf;
+            Modes.max_noicefloor_close = Modes.in->adapt.mnfc;
+        }
+        Modes.candidates = slotCandidates(block);
+        Modes.candidates_stale = !thresholdsCover(*slotThresholds(block), currentThresholds());
+        Modes.in->block_length = len * Modes.pair_bytes;
+        carryTail(mlen, detectMode(m, mlen, start));
+        if (Modes.adaptive == true) {
+            /* Noise level of the samples from the first one not scanned with the previous block */
+            adaptThresholds(m + first, mlen - first);
+            publishThresholds(Modes.in);
+        }
+        PROFILE_NOW(detected);
+        ringRelease(&Modes.in->mag_ring);
+        if (Modes.metrics_fd >= 0) {
+            struct timespec done;
 
-            computeMagnitudeVector();
-            pthread_mutex_unlock(&Modes.data_mutex);
-            Modes.data_ready = false;
-            pthread_cond_signal(&Modes.data_cond);
+            clock_gettime(CLOCK_MONOTONIC, &done);
+            metricsPublish(len, (done.tv_sec - started.tv_sec) * 1000000000ULL + done.tv_nsec - started.tv_nsec);
+        }
+        printStats();
+        if (Modes.stats_interval > 0 && Modes.in->sample_base >= Modes.in->traffic.next_report) {
+            printTrafficStats(Modes.in->sample_base);
+        }
+#ifdef MODES_PROFILE
+        if (Modes.profile_print.exchange(false, std::memory_order_relaxed)) reportPrintf("%s", profileSummary().c_str());
+#endif
+        reportFlush();
+        eventFlush();
+#ifdef MODES_PROFILE
+        if (Modes.profile) {
+            uint64_t done = profileNow();
 
-            detectMode(Modes.magnitude);
-            printStats();
-            pthread_mutex_lock(&Modes.data_mutex);
+            PROFILE_ADD(PROF_DETECT, detected - detect_start);
+            PROFILE_ADD(PROF_OUTPUT, done - detected);
+            PROFILE_ADD(PROF_TO_DETECT, detected - captured);
+            PROFILE_ADD(PROF_TO_OUTPUT, done - captured);
         }
+#endif
     }
+    /* Real time factor is of one input, they are replayed side by side */
+    uint64_t samples = 0;
+    int cumulative_countm = 0;
+    struct timespec replay_start = Modes.input[0].replay_start;
+    for (int k = 0; k < Modes.inputs; k++) {
+        struct input *in = &Modes.input[k];
 
-    else
+        samples += in->sample_base;
+        cumulative_countm += in->cumulative_countm;
+        if (in->replay_start.tv_sec < replay_start.tv_sec ||
+            (in->replay_start.tv_sec == replay_start.tv_sec && in->replay_start.tv_nsec < replay_start.tv_nsec)) replay_start = in->replay_start;
+    }
+    if (Modes.filename != NULL)
     {
-        if (Modes.data_ready == false) {
-            pthread_cond_wait(&Modes.data_cond,&Modes.data_mutex);
-        }
+        struct timespec done;
+        double seconds;
 
-        computeMagnitudeVector();
-        pthread_mutex_unlock(&Modes.data_mutex);
-        Modes.data_ready = false;
-        pthread_cond_signal(&Modes.data_cond);
-        detectMode(Modes.magnitude);
-        printStats();
-        pthread_mutex_lock(&Modes.data_mutex);
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        seconds = done.tv_sec - replay_start.tv_sec + (done.tv_nsec - replay_start.tv_nsec) / 1e9;
+        reportPrintf("Replayed %llu samples (%.1f s) in %.3f s: %.1f Msamples/s, %.2f times real time\n",
+            (unsigned long long) samples, (double) samples / Modes.samplerate, seconds,
+            seconds > 0 ? samples / seconds / 1e6 : 0, seconds > 0 ? samples / (seconds * Modes.samplerate * Modes.inputs) : 0);
+    }
+    if (Modes.filename != NULL && cumulative_countm == 0)
+    {
+        reportPrintf("No messages detected.");
+    }
+    for (int k = 0; k < Modes.inputs; k++) {
+        Modes.in = &Modes.input[k];
+        if (Modes.stats_interval > 0 && Modes.in->traffic.reported != Modes.in->sample_base) {
+            printTrafficStats(Modes.in->sample_base);
+        }
+    }
+    reportFlush();
+    ringClose(&Modes.report_ring);
+    if (Modes.events_fd >= 0) {
+        eventFlush();
+        ringClose(&Modes.event_ring);
+        pthread_join(Modes.events_thread, NULL);
+        close(Modes.events_fd);
     }
 
-    rtlsdr_close(Modes.dev);
+    for (int k = 0; k < Modes.inputs; k++) {
+        pthread_join(Modes.input[k].reader_thread, NULL);
+        pthread_join(Modes.input[k].magnitude_thread, NULL);
+    }
+    pthread_join(Modes.reporter_thread, NULL);
+    if (Modes.record_fd >= 0) {
+        pthread_join(Modes.record_thread, NULL);
+        close(Modes.record_fd);
+        printf("Recorded %llu bytes to %s, %llu bytes dropped.\n",
+            (unsigned long long) Modes.record_written.load(std::memory_order_relaxed), Modes.record_name,
+            (unsigned long long) Modes.record_dropped.load(std::memory_order_relaxed));
+    }
+    if (Modes.metrics_fd >= 0 && strchr(Modes.metrics_addr, '/') != NULL) unlink(Modes.metrics_addr);
+    if (Modes.control_fd >= 0) unlink(Modes.control_path);
+#ifdef MODES_PROFILE
+    if (Modes.profile) printf("%s", profileSummary().c_str());
+#endif
+    for (int k = 0; k < Modes.inputs; k++) {
+        if (Modes.input[k].dev != NULL) rtlsdr_close(Modes.input[k].dev);
+    }
     return 0;
 }
+#endif
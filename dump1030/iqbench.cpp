@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <vector>
+#include <string>
+#include "iqsynth.h"
+
+using namespace std;
+
+#define BENCH_TOLERANCE            2            /* Samples a detection may be off from the ground truth */
+
+/* End to end benchmark of dump1030 --file against an iqgen ground truth.
+ * Throughput and peak memory are measured without --msgs so printing doesn't
+ * count, accuracy from a separate run with --msgs. */
+
+struct truthEvent {
+    uint64_t sample;
+    int code;
+    bool matched;
+};
+
+struct runResult {
+    double seconds;                 /* Wall clock time */
+    double cpu;                     /* User and system time */
+    long max_rss;                   /* Peak resident set size in kilobytes */
+    int status;
+};
+
+/* Message prefixes printed by dump1030 --msgs and their order numbers */
+static const struct { const char *prefix; int code; } messageTypes[] = {
+    { "Mode S message in starting from bit number: ", 3 },
+    { "Mode A all-call Message in location: ", 21 },
+    { "Mode C all-call Message in location: ", 22 },
+    { "Mode A all-call (Compatibility mode) Message starting from bit number: ", 31 },
+    { "Mode C all-call (Compatibility mode) Message starting from bit number: ", 32 },
+    { "Mode A Message starting from bit number: ", 11 },
+    { "Mode C Message starting from bit number: ", 12 },
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs dump1030 with args. Standard output goes to out or /dev/null. */
+static struct runResult runDump1030(vector<string> &args, FILE **out, pid_t *child) {
+    struct runResult r;
+    vector<char *> argv;
+    int fds[2] = { -1, -1 };
+
+    for (auto &a : args) argv.push_back((char *) a.c_str());
+    argv.push_back(NULL);
+    if (out != NULL && pipe(fds) != 0) {
+        fprintf(stderr, "pipe: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    r.seconds = now();
+    *child = fork();
+    if (*child == 0) {
+        int fd = out != NULL ? fds[1] : open("/dev/null", O_WRONLY);
+
+        dup2(fd, 1);
+        if (out != NULL) close(fds[0]);
+        execv(argv[0], argv.data());
+        fprintf(stderr, "Error running %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    if (out != NULL) {
+        close(fds[1]);
+        *out = fdopen(fds[0], "r");
+    }
+    return r;
+}
+
+static void waitDump1030(pid_t child, struct runResult *r) {
+    struct rusage usage;
+
+    wait4(child, &r->status, 0, &usage);
+    r->seconds = now() - r->seconds;
+    r->cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    r->max_rss = usage.ru_maxrss;
+}
+
+static int typeIndex(int code) {
+    for (int j = 0; j < SYNTH_TYPES; j++) {
+        if (synthCodes[j] == code) return j;
+    }
+    return -1;
+}
+
+void showHelp(void) {
+    printf("Usage: iqbench [--runs N] <dump1030> <file> [dump1030 options]\n"
+    "Runs dump1030 --file <file> and compares detections against <file>.truth written by iqgen.\n"
+    "--runs             Throughput runs, the fastest is reported (default 3)\n");
+}
+
+int main(int argc, char **argv) {
+    vector<struct truthEvent> truth;
+    vector<string> args;
+    double rate = 2500000;
+    int runs = 3;
+    int i = 1;
+    char line[4096];
+
+    if (i + 1 < argc && !strcmp(argv[i], "--runs")) {
+        runs = atoi(argv[i+1]);
+        if (runs < 1) runs = 1;
+        i += 2;
+    }
+    if (argc - i < 2) {
+        showHelp();
+        exit(1);
+    }
+    const char *program = argv[i];
+    const char *file = argv[i+1];
+
+    /* Ground truth */
+    string truthname = string(file) + ".truth";
+    FILE *f = fopen(truthname.c_str(), "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", truthname.c_str(), strerror(errno));
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long sample;
+        int code;
+
+        if (line[0] == '#') {
+            char *p = strstr(line, "rate ");
+            if (p != NULL && p == line + 2) rate = atof(p + 5);
+            continue;
+        }
+        if (sscanf(line, "%llu %d", &sample, &code) == 2) truth.push_back({ sample, code, false });
+    }
+    fclose(f);
+
+    struct stat st;
+    if (stat(file, &st) != 0) {
+        fprintf(stderr, "Error opening %s: %s\n", file, strerror(errno));
+        exit(1);
+    }
+    double samples = st.st_size / 2;
+
+    args.push_back(program);
+    args.push_back("--file");
+    args.push_back(file);
+    if (rate != 2500000) {
+        args.push_back("--rate");
+        args.push_back(to_string((long) rate));
+    }
+    for (int j = i + 2; j < argc; j++) args.push_back(argv[j]);
+
+    /* Throughput, fastest of the runs */
+    struct runResult best;
+    best.seconds = 1e30;
+    best.max_rss = 0;
+    best.cpu = 0;
+    for (int run = 0; run < runs; run++) {
+        pid_t child;
+        struct runResult r = runDump1030(args, NULL, &child);
+
+        waitDump1030(child, &r);
+        if (!WIFEXITED(r.status) || WEXITSTATUS(r.status) != 0) {
+            fprintf(stderr, "%s failed with status %d\n", program, r.status);
+            exit(1);
+        }
+        if (r.max_rss > best.max_rss) best.max_rss = r.max_rss;
+        if (r.seconds < best.seconds) {
+            best.seconds = r.seconds;
+            best.cpu = r.cpu;
+        }
+    }
+
+    /* Accuracy */
+    vector<uint64_t> detected[SYNTH_TYPES];
+    int detected_total[SYNTH_TYPES] = { 0 };
+    FILE *out;
+    pid_t child;
+
+    args.push_back("--msgs");
+    struct runResult r = runDump1030(args, &out, &child);
+    while (fgets(line, sizeof(line), out)) {
+        for (auto &t : messageTypes) {
+            size_t len = strlen(t.prefix);
+
+            if (strncmp(line, t.prefix, len) == 0) {
+                int j = typeIndex(t.code);
+
+                detected[j].push_back(strtoull(line + len, NULL, 10));
+                detected_total[j]++;
+                break;
+            }
+        }
+    }
+    fclose(out);
+    waitDump1030(child, &r);
+
+    /* A detection is correct if an unmatched interrogation of the same type starts
+     * within BENCH_TOLERANCE samples. Both lists are in sample order. */
+    int truth_total[SYNTH_TYPES] = { 0 };
+    int matched[SYNTH_TYPES] = { 0 };
+    vector<struct truthEvent> bytype[SYNTH_TYPES];
+
+    for (auto &e : truth) {
+        int j = typeIndex(e.code);
+
+        if (j < 0) continue;
+        bytype[j].push_back(e);
+        truth_total[j]++;
+    }
+    for (int j = 0; j < SYNTH_TYPES; j++) {
+        size_t k = 0;
+
+        for (uint64_t pos : detected[j]) {
+            while (k < bytype[j].size() && bytype[j][k].sample + BENCH_TOLERANCE < pos) k++;
+            for (size_t m = k; m < bytype[j].size() && bytype[j][m].sample <= pos + BENCH_TOLERANCE; m++) {
+                if (bytype[j][m].matched == false) {
+                    bytype[j][m].matched = true;
+                    matched[j]++;
+                    break;
+                }
+            }
+        }
+    }
+
+    printf("Samples:                                                    %.0f (%.1f s at %.1f MSPS)\n"
+    "Wall time (fastest of %d):                                  %.3f s\n"
+    "CPU time:                                                   %.3f s\n"
+    "Throughput:                                                 %.1f Msamples/s\n"
+    "Real time factor:                                           %.1f\n"
+    "Peak RSS:                                                   %ld kB\n\n",
+        samples, samples / rate, rate / 1e6, runs, best.seconds, best.cpu,
+        samples / best.seconds / 1e6, samples / rate / best.seconds, best.max_rss);
+
+    int all_truth = 0;
+    int all_matched = 0;
+    int all_detected = 0;
+    printf("%-38s %8s %8s %8s %8s %8s\n", "Type", "Truth", "Found", "Correct", "Recall", "False");
+    for (int j = 0; j < SYNTH_TYPES; j++) {
+        printf("%-38s %8d %8d %8d %7.1f%% %8d\n", synthNames[j], truth_total[j], detected_total[j], matched[j],
+            truth_total[j] ? 100.0 * matched[j] / truth_total[j] : 0.0, detected_total[j] - matched[j]);
+        all_truth += truth_total[j];
+        all_matched += matched[j];
+        all_detected += detected_total[j];
+    }
+    printf("%-38s %8d %8d %8d %7.1f%% %8d\n", "Total", all_truth, all_detected, all_matched,
+        all_truth ? 100.0 * all_matched / all_truth : 0.0, all_detected - all_matched);
+    return 0;
+}
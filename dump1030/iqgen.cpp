@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <vector>
+#include <string>
+#include "iqsynth.h"
+
+using namespace std;
+
+/* Writes synthetic SSR interrogations as unsigned 8 bit I/Q pairs that dump1030
+ * can read with --file, and the ground truth next to it in <file>.truth:
+ * one line per interrogation with P1 sample, dump1030 order number and amplitude. */
+
+void showHelp(void) {
+    printf("Usage: iqgen --out <file> [options]\n"
+    "--out              I/Q file to write, ground truth goes to <file>.truth\n"
+    "--seconds          Length of the recording (default 10)\n"
+    "--rate             Sample rate (default 2500000)\n"
+    "--irate            Average interrogations per second (default 5000)\n"
+    "--snr              Pulse amplitude over noise deviation in dB (default 26)\n"
+    "--snrspread        Pulse amplitudes vary randomly by +- this many dB (default 4)\n"
+    "--noise            Noise standard deviation of I and Q (default 3)\n"
+    "--overlap          Share of interrogations starting inside the previous one (default 0.05)\n"
+    "--mix              Relative shares of Mode A, Mode C, A all-call, C all-call, A all-call (Compatibility mode),\n"
+    "                   C all-call (Compatibility mode) and Mode S, for example 1,1,1,1,1,1,4 (default all 1)\n"
+    "--seed             Random seed (default 1)\n"
+    "--help             Show this help\n");
+}
+
+int main(int argc, char **argv) {
+    struct synthConfig c;
+    vector<struct synthEvent> events;
+    const char *out = NULL;
+    int i;
+
+    synthDefaults(&c);
+    for (i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+
+        if (!strcmp(argv[i],"--out") && more) {
+            out = argv[++i];
+        } else if (!strcmp(argv[i],"--seconds") && more) {
+            c.seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--rate") && more) {
+            c.rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--irate") && more) {
+            c.interrogations = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--snr") && more) {
+            c.snr = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--snrspread") && more) {
+            c.snr_spread = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--noise") && more) {
+            c.noise = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--overlap") && more) {
+            c.overlap = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"--mix") && more) {
+            char *p = argv[++i];
+            for (int j = 0; j < SYNTH_TYPES && *p; j++) {
+                c.mix[j] = strtod(p, &p);
+                if (*p == ',') p++;
+            }
+        } else if (!strcmp(argv[i],"--seed") && more) {
+            c.seed = atoi(argv[++i]);
+        } else {
+            showHelp();
+            exit(1);
+        }
+    }
+    if (out == NULL || c.rate <= 0 || c.seconds <= 0) {
+        showHelp();
+        exit(1);
+    }
+
+    synthEvents(&c, events);
+
+    string truthname = string(out) + ".truth";
+    FILE *f = fopen(out, "wb");
+    FILE *truth = fopen(truthname.c_str(), "w");
+    if (f == NULL || truth == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", f == NULL ? out : truthname.c_str(), strerror(errno));
+        exit(1);
+    }
+
+    /* Header lines start with # and are skipped by iqbench */
+    fprintf(truth, "# rate %.0f seconds %g irate %g snr %g snrspread %g noise %g overlap %g seed %u\n",
+        c.rate, c.seconds, c.interrogations, c.snr, c.snr_spread, c.noise, c.overlap, c.seed);
+    fprintf(truth, "# sample order amplitude\n");
+    for (auto &e : events) {
+        fprintf(truth, "%llu %d %.1f\n", (unsigned long long) floor(e.start * c.rate / 1e6),
+            synthCodes[e.type], e.amplitude);
+    }
+    fclose(truth);
+
+    uint64_t samples = (uint64_t) (c.seconds * c.rate);
+    vector<unsigned char> buf(2 * SYNTH_CHUNK);
+    uint32_t noise_state = c.seed * 2654435761u + 1;
+    size_t next = 0;
+
+    for (uint64_t first = 0; first < samples; first += SYNTH_CHUNK) {
+        uint32_t n = samples - first < SYNTH_CHUNK ? samples - first : SYNTH_CHUNK;
+
+        synthChunk(&c, events, &next, first, n, &noise_state, buf.data());
+        if (fwrite(buf.data(), 2, n, f) != n) {
+            fprintf(stderr, "Error writing %s: %s\n", out, strerror(errno));
+            exit(1);
+        }
+    }
+    fclose(f);
+    printf("Wrote %llu samples and %zu interrogations to %s\n", (unsigned long long) samples, events.size(), out);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/* Synthetic SSR interrogation I/Q data, shared by the iqgen generator and the
+ * benchmarks. Pulses are rendered by integrating their envelope over every
+ * sample period, so edges fall between samples like with a real receiver. */
+#ifndef IQSYNTH_H
+#define IQSYNTH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#define SYNTH_TYPES                7
+#define SYNTH_CHUNK                1048576      /* Samples rendered at a time */
+
+/* Interrogation types in the order of dump1030 order numbers */
+static const int synthCodes[SYNTH_TYPES] = { 11, 12, 21, 22, 31, 32, 3 };
+static const char * const synthNames[SYNTH_TYPES] = {
+    "Mode A", "Mode C", "Mode A All-Call", "Mode C All-Call",
+    "Mode A All-Call (Compatibility Mode)", "Mode C All-Call (Compatibility Mode)", "Mode S"
+};
+
+struct synthConfig {
+    double rate;                    /* Samples per second */
+    double seconds;
+    double interrogations;          /* Average interrogations per second */
+    double snr;                     /* Pulse amplitude over noise deviation in dB */
+    double snr_spread;              /* Pulse amplitudes vary +-snr_spread dB */
+    double noise;                   /* Noise standard deviation of I and Q */
+    double overlap;                 /* Share of interrogations starting inside the previous one */
+    double mix[SYNTH_TYPES];        /* Relative share of each type */
+    uint32_t seed;
+};
+
+/* One interrogation of the ground truth */
+struct synthEvent {
+    double start;                   /* Start of P1 in microseconds */
+    double length;                  /* Microseconds until end of last pulse */
+    int type;                       /* Index to synthCodes */
+    double amplitude;               /* Pulse amplitude in I/Q units */
+    double phase;
+    uint32_t bits;                  /* Mode S P6 phase reversals */
+};
+
+static inline void synthDefaults(struct synthConfig *c) {
+    c->rate = 2500000;
+    c->seconds = 10;
+    c->interrogations = 5000;
+    c->snr = 26;
+    c->snr_spread = 4;
+    c->noise = 3;
+    c->overlap = 0.05;
+    for (int j = 0; j < SYNTH_TYPES; j++) c->mix[j] = 1;
+    c->seed = 1;
+}
+
+/* xorshift32, same sequence on every platform */
+static inline double synthRandom(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state >> 8) * (1.0 / 16777216.0);
+}
+
+static inline double synthGauss(uint32_t *state) {
+    double u = synthRandom(state);
+    double v = synthRandom(state);
+
+    return sqrt(-2.0 * log(u + 1e-12)) * cos(2 * M_PI * v);
+}
+
+/* Pulses of an interrogation: start and width in microseconds from P1 */
+static inline int synthPulses(const struct synthEvent *e, double start[3], double width[3]) {
+    static const double p3[2] = { 8.0, 21.0 };
+
+    start[0] = 0;
+    width[0] = 0.8;
+    if (e->type == 6) {
+        /* Mode S: P1, P2 and the P6 data block */
+        start[1] = 2.0;
+        width[1] = 0.8;
+        start[2] = 3.5;
+        width[2] = e->length - 3.5;
+        return 3;
+    }
+    start[1] = p3[e->type % 2];
+    width[1] = 0.8;
+    if (e->type < 2) return 2;
+    start[2] = start[1] + 2.0;
+    width[2] = e->type < 4 ? 0.8 : 1.6;
+    return 3;
+}
+
+/* Draws the interrogations of the whole run. */
+static inline void synthEvents(const struct synthConfig *c, std::vector<struct synthEvent> &events) {
+    uint32_t state = c->seed ? c->seed : 1;
+    double total = 0;
+    double t = 5;
+    double end = c->seconds * 1e6 - 40;
+
+    for (int j = 0; j < SYNTH_TYPES; j++) total += c->mix[j];
+    events.clear();
+    while (total > 0) {
+        struct synthEvent e;
+        double pick = synthRandom(&state) * total;
+        int type = 0;
+
+        while (type < SYNTH_TYPES - 1 && (pick -= c->mix[type]) >= 0) type++;
+        e.type = type;
+        if (type == 6) e.length = synthRandom(&state) < 0.5 ? 19.75 : 33.75;
+        else if (type < 2) e.length = (type == 0 ? 8.0 : 21.0) + 0.8;
+        else e.length = (type % 2 == 0 ? 10.0 : 23.0) + (type < 4 ? 0.8 : 1.6);
+        e.amplitude = c->noise * pow(10, (c->snr + (2 * synthRandom(&state) - 1) * c->snr_spread) / 20);
+        e.phase = 2 * M_PI * synthRandom(&state);
+        e.bits = (uint32_t) (synthRandom(&state) * 4294967295.0);
+
+        /* Poisson arrivals, kept apart unless picked to overlap */
+        if (events.empty() == false) {
+            const struct synthEvent &prev = events.back();
+
+            if (synthRandom(&state) < c->overlap) {
+                t = prev.start + 1.0 + synthRandom(&state) * (prev.length - 1.0);
+            } else {
+                t += -log(synthRandom(&state) + 1e-12) * 1e6 / c->interrogations;
+                if (t < prev.start + prev.length + 2.0) t = prev.start + prev.length + 2.0;
+            }
+        }
+        if (t >= end) break;
+        e.start = t;
+        events.push_back(e);
+    }
+}
+
+/* Adds amplitude a with phase ph over [t0, t1) microseconds to a chunk of samples starting at first */
+static inline void synthBox(float *i, float *q, uint64_t first, uint32_t n, double rate, double t0, double t1, double a, double ph) {
+    double s0 = t0 * rate / 1e6 - first;
+    double s1 = t1 * rate / 1e6 - first;
+    long k0 = (long) floor(s0);
+    long k1 = (long) ceil(s1);
+    float ci = a * cos(ph);
+    float cq = a * sin(ph);
+
+    if (k0 < 0) k0 = 0;
+    if (k1 > (long) n) k1 = n;
+    for (long k = k0; k < k1; k++) {
+        double cover = fmin(s1, k + 1) - fmax(s0, k);
+
+        if (cover > 0) {
+            i[k] += ci * cover;
+            q[k] += cq * cover;
+        }
+    }
+}
+
+/* Renders an interrogation into a chunk. The Mode S data block is made of 0.25 us
+ * chips with 180 degree phase reversals, which show up as dips in the magnitude. */
+static inline void synthRender(const struct synthEvent *e, float *i, float *q, uint64_t first, uint32_t n, double rate) {
+    double start[3];
+    double width[3];
+    int pulses = synthPulses(e, start, width);
+
+    for (int p = 0; p < pulses; p++) {
+        double t0 = e->start + start[p];
+
+        if (e->type == 6 && p == 2) {
+            double ph = e->phase;
+            int chip = 0;
+
+            /* Sync phase reversal 1.25 us after start, then one chip per data bit */
+            synthBox(i, q, first, n, rate, t0, t0 + 1.25, e->amplitude, ph);
+            for (double t = t0 + 1.25; t < t0 + width[p] - 0.001; t += 0.25, chip++) {
+                if (chip == 0 || (e->bits >> (chip % 32) & 1)) ph += M_PI;
+                synthBox(i, q, first, n, rate, t, fmin(t + 0.25, t0 + width[p]), e->amplitude, ph);
+            }
+        } else {
+            synthBox(i, q, first, n, rate, t0, t0 + width[p], e->amplitude, e->phase);
+        }
+    }
+}
+
+/* Renders samples [first, first+n) of the run as unsigned 8 bit I/Q pairs. next is
+ * the first event that can still reach this chunk, events must be rendered in order. */
+static inline void synthChunk(const struct synthConfig *c, const std::vector<struct synthEvent> &events, size_t *next,
+                       uint64_t first, uint32_t n, uint32_t *noise_state, unsigned char *out)
+{
+    std::vector<float> i(n, 0.0f), q(n, 0.0f);
+    double chunk_start = first * 1e6 / c->rate;
+    double chunk_end = (first + n) * 1e6 / c->rate;
+
+    while (*next < events.size() && events[*next].start + events[*next].length < chunk_start) (*next)++;
+    for (size_t e = *next; e < events.size() && events[e].start < chunk_end; e++) {
+        synthRender(&events[e], i.data(), q.data(), first, n, c->rate);
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        int vi = (int) lround(127 + i[k] + c->noise * synthGauss(noise_state));
+        int vq = (int) lround(127 + q[k] + c->noise * synthGauss(noise_state));
+
+        out[2*k] = vi < 0 ? 0 : vi > 255 ? 255 : vi;
+        out[2*k+1] = vq < 0 ? 0 : vq > 255 ? 255 : vq;
+    }
+}
+
+#endif
@@ -0,0 +1,609 @@
+/* Microbenchmark of the dump1030 detection kernels. Every kernel is timed in
+ * nanoseconds per sample on fixed synthetic buffers: quiet noise, dense
+ * interrogations and saturated input. Before timing, the optimized kernels are
+ * compared against frozen copies of the original scalar code on randomized
+ * data and thresholds, and any difference fails the run.
+ *
+ * The reference functions below are the checks of the original detectMode at
+ * 2.5 MSPS with float divisions. They must not be changed when the detector is. */
+#define DUMP1030_NO_MAIN
+#include "dump1030.cpp"
+#include <time.h>
+#include "iqsynth.h"
+
+#define BENCH_RATE                 2500000      /* Rate of the reference code */
+#define BENCH_SAMPLES              1048576      /* Samples in each fixed buffer */
+#define BENCH_MIN_SECONDS          0.05         /* Shortest timed run of a kernel */
+
+typedef pulseOffsets<BENCH_RATE> benchOffsets;
+
+/* Original magnitude table, zero amplitude still zero */
+static uint8_t refMaglut[129*129];
+
+static void refMagnitudeTable(void) {
+    int i;
+    int q;
+
+    for (i = 0; i <= 128; i++) {
+        for (q = 0; q <= 128; q++) {
+            refMaglut[i*129+q] = round(sqrt(i*i+q*q)*1.405);
+        }
+    }
+}
+
+static void refMagnitudeVector(const unsigned char *p, uint32_t len, uint8_t *m) {
+    uint32_t j;
+    for (j = 0; j < len; j += 2) {
+        int i = p[j]-127;
+        int q = p[j+1]-127;
+
+        if (i < 0) i = -i;
+        if (q < 0) q = -q;
+        m[j/2] = refMaglut[i*129+q];
+    }
+}
+
+/* Sets zeroes to ones in amplitude data to avoid floation point exceptions. */
+static void refZeroFixup(uint8_t *m, uint32_t n) {
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        if (m[i] == 0) { m[i] = 1; }
+    }
+}
+
+static bool refP1(const uint8_t *m, int i) {
+    return !((float) m[i+2]/m[i] > Modes.diffratioclose || (float) m[i+2]/m[i+1] > Modes.diffratioclose ||
+        (float) m[i+3]/m[i] > Modes.diffratio || (float) m[i+3]/m[i+1] > Modes.diffratio ||
+         m[i]<=m[i+2]+Modes.diff || m[i+1]<=m[i+2]+Modes.diff ||
+         m[i]<=m[i+3]+Modes.diff || m[i+1]<=m[i+3]+Modes.diff ||
+         m[i]<=m[i+4]+Modes.diff || m[i+1]<=m[i+4]+Modes.diff ||
+         m[i]<=m[i+7]+Modes.diff || m[i+1]<=m[i+7]+Modes.diff ||
+         m[i]<=Modes.min_peak_amp || m[i+1]<=Modes.min_peak_amp ||
+         m[i+2]>=Modes.max_noicefloor_close || m[i+3]>=Modes.max_noicefloor);
+}
+
+static bool refModeS(const uint8_t *m, int i) {
+    return m[i+5] >= m[i+3]+Modes.diff &&
+        m[i+6] >= m[i+3]+Modes.diff &&
+        m[i+5] >= m[i+4]+Modes.diffclose &&
+        m[i+6] >= m[i+4]+Modes.diffclose &&
+        m[i+5] >= m[i+2]+Modes.diffclose &&
+        m[i+6] >= m[i+2]+Modes.diffclose &&
+        m[i+5] >= m[i+7]+Modes.diffclose &&
+        m[i+6] >= m[i+7]+Modes.diffclose &&
+        m[i+5] >= m[i+8]+Modes.diffclose &&
+        m[i+6] >= m[i+8]+Modes.diffclose &&
+        m[i+5] >= Modes.min_peak_amp &&
+        m[i+6] >= Modes.min_peak_amp &&
+        m[i+2] <= Modes.max_noicefloor_close &&
+        m[i+3] <= Modes.max_noicefloor &&
+        m[i+4] <= Modes.max_noicefloor_close &&
+        m[i+7] <= Modes.max_noicefloor_close &&
+        m[i+8] <= Modes.max_noicefloor_close &&
+        (float) m[i+4]/m[i] < Modes.diffratioclose &&
+        (float) m[i+4]/m[i+1] < Modes.diffratioclose &&
+        (float) m[i+7]/m[i] < Modes.diffratioclose &&
+        (float) m[i+7]/m[i+1] < Modes.diffratioclose &&
+        (float) m[i+3]/m[i+5] < Modes.diffratio &&
+        (float) m[i+3]/m[i+6] < Modes.diffratio &&
+        (float) m[i+4]/m[i+5] < Modes.diffratioclose &&
+        (float) m[i+4]/m[i+6] < Modes.diffratioclose &&
+        (float) m[i+2]/m[i+5] < Modes.diffratioclose &&
+        (float) m[i+2]/m[i+6] < Modes.diffratioclose &&
+        (float) m[i+7]/m[i+5] < Modes.diffratioclose &&
+        (float) m[i+7]/m[i+6] < Modes.diffratioclose &&
+        (float) m[i+8]/m[i+5] < Modes.diffratioclose &&
+        (float) m[i+8]/m[i+6] < Modes.diffratioclose;
+}
+
+static bool refModeA(const uint8_t *m, int i) {
+    int a;
+
+    if (m[i+20]<Modes.min_peak_amp || m[i+21]<Modes.min_peak_amp) { return false; }
+    for (a = 3; a < 19; a++)
+    {
+        if (m[i+a]+Modes.diff>=m[i+20] || m[i+a]/(float) m[i+20] > Modes.diffratio) { return false; }
+        if (m[i+a]+Modes.diff>=m[i+21] || m[i+a]/(float) m[i+21] > Modes.diffratio) { return false; }
+        if (m[i+a]>Modes.max_noicefloor) { return false; }
+    }
+    return !(m[i+22]+Modes.diffclose>=m[i+20]   || m[i+22]+Modes.diffclose>=m[i+21] ||
+        m[i+23]+Modes.diff>=m[i+20]        || m[i+23]+Modes.diff>=m[i+21]      ||
+        m[i+24]+Modes.diffclose>=m[i+20]   || m[i+24]+Modes.diffclose>=m[i+21] ||
+        m[i+19]+Modes.diffclose>=m[i+20]   || m[i+19]+Modes.diffclose>=m[i+21] ||
+        m[i+2]+Modes.diffclose>=m[i+20]    || m[i+2]+Modes.diffclose>=m[i+21]  ||
+        m[i+22]>Modes.max_noicefloor_close ||
+        m[i+23]>Modes.max_noicefloor       ||
+        m[i+24]>Modes.max_noicefloor       ||
+        m[i+19]>Modes.max_noicefloor_close ||
+        m[i+20]<Modes.min_peak_amp         ||
+        m[i+21]<Modes.min_peak_amp         ||
+        (float) m[i+2]/m[i+20] > Modes.diffratioclose  ||
+        (float) m[i+2]/m[i+21] > Modes.diffratioclose  ||
+        (float) m[i+22]/m[i+20] > Modes.diffratioclose ||
+        (float) m[i+22]/m[i+21] > Modes.diffratioclose ||
+        (float) m[i+23]/m[i+20] > Modes.diffratio      ||
+        (float) m[i+23]/m[i+21] > Modes.diffratio);
+}
+
+/* The P3 loop divides integers, as the original did */
+static bool refModeC(const uint8_t *m, int i) {
+    int c;
+
+    for (c = 3; c < 51; c++) {
+        if (m[i+c]+Modes.diff>m[i+52] || m[i+c]/m[i+52] > Modes.diffratio) { return false; }
+        if (m[i+c]+Modes.diff>m[i+53] || m[i+c]/m[i+53] > Modes.diffratio) { return false; }
+        if (m[i+c]>Modes.max_noicefloor) { return false; }
+    }
+    return !(m[i+54]+Modes.diffclose>=m[i+52] || m[i+54]+Modes.diffclose>=m[i+53] ||
+        m[i+55]+Modes.diff>=m[i+52]      || m[i+55]+Modes.diff>=m[i+53]      ||
+        m[i+56]+Modes.diffclose>=m[i+52] || m[i+56]+Modes.diffclose>=m[i+53] ||
+        m[i+2]+Modes.diffclose>=m[i+52]  || m[i+51]+Modes.diffclose>=m[i+53] ||
+        m[i+54]>Modes.max_noicefloor_close ||
+        m[i+55]>Modes.max_noicefloor       ||
+        m[i+56]>Modes.max_noicefloor       ||
+        m[i+51]>Modes.max_noicefloor_close ||
+        m[i+52]<Modes.min_peak_amp         ||
+        m[i+53]<Modes.min_peak_amp         ||
+        (float) m[i+2]/m[i+52] > Modes.diffratioclose ||
+        (float) m[i+2]/m[i+53] > Modes.diffratioclose ||
+        (float) m[i+51]/m[i+52] > Modes.diffratioclose ||
+        (float) m[i+51]/m[i+53] > Modes.diffratioclose ||
+        (float) m[i+54]/m[i+52] > Modes.diffratioclose ||
+        (float) m[i+54]/m[i+53] > Modes.diffratioclose ||
+        (float) m[i+55]/m[i+52] > Modes.diffratio ||
+        (float) m[i+55]/m[i+53] > Modes.diffratio);
+}
+
+static bool refShortP4(const uint8_t *m, int i, int os) {
+    return (float) m[i+os-1]/m[i+os]<Modes.diffratioclosep4 && (float) m[i+os-1]/m[i+os+1]<Modes.diffratioclosep4
+        && (float) m[i+os-2]/m[i+os]<Modes.diffratiop4      && (float) m[i+os-2]/m[i+os+1]<Modes.diffratiop4
+        && (float) m[i+os-3]/m[i+os]<Modes.diffratioclosep4 && (float) m[i+os-3]/m[i+os+1]<Modes.diffratioclosep4
+        && (float) m[i+os+2]/m[i+os]<Modes.diffratioclosep4 && (float) m[i+os+2]/m[i+os+1]<Modes.diffratioclosep4
+        && (float) m[i+os+3]/m[i+os]<Modes.diffratiop4 && (float) m[i+os+3]/m[i+os+1]<Modes.diffratiop4
+        && m[i+os] > Modes.min_peak_amp && m[i+os+1] > Modes.min_peak_amp
+        && m[i+os+2] < Modes.max_noicefloor_close && m[i+os-1] < Modes.max_noicefloor_close
+        && m[i+os-2] < Modes.max_noicefloor && m[i+os-3] < Modes.max_noicefloor_close;
+}
+
+static bool refLongP4(const uint8_t *m, int i, int os) {
+    return (float) m[i+os-1]/m[i+os] < Modes.diffratioclosep4 && (float) m[i+os-1]/m[i+os+1] < Modes.diffratioclosep4
+        && (float) m[i+os-1]/m[i+os+2] < Modes.diffratioclosep4 && (float) m[i+os-1]/m[i+os+3] < Modes.diffratioclosep4
+        && (float) m[i+os-2]/m[i+os] < Modes.diffratiop4 && (float) m[i+os-2]/m[i+os+1] < Modes.diffratiop4
+        && (float) m[i+os-2]/m[i+os+2] < Modes.diffratiop4 && (float) m[i+os-2]/m[i+os+3] < Modes.diffratiop4
+        && (float) m[i+os-3]/m[i+os] < Modes.diffratioclosep4 && (float) m[i+os-3]/m[i+os+1] < Modes.diffratioclosep4
+        && (float) m[i+os-3]/m[i+os+2] < Modes.diffratioclosep4 && (float) m[i+os-3]/m[i+os+3] < Modes.diffratioclosep4
+        && (float) m[i+os+4]/m[i+os] < Modes.diffratioclosep4 && (float) m[i+os+4]/m[i+os+1] < Modes.diffratioclosep4
+        && (float) m[i+os+4]/m[i+os+2] < Modes.diffratioclosep4 && (float) m[i+os+4]/m[i+os+3] < Modes.diffratioclosep4
+        && m[i+os] > Modes.min_peak_amp && m[i+os+1] > Modes.min_peak_amp && m[i+os+2] > Modes.min_peak_amp && m[i+os+3] > Modes.min_peak_amp
+        && m[i+os-1] < Modes.max_noicefloor_close && m[i+os+4] < Modes.max_noicefloor_close && m[i+os-3] < Modes.max_noicefloor_close
+        && m[i+os-2] < Modes.max_noicefloor;
+}
+
+/* P6 length of measureP6 at 2.5 MSPS, which came after the original code: P6
+ * from sample 9, short P6 ends at 49 and long at 84, a sample is left out at
+ * each end of the windows. Offset from P1 where scanning continues. */
+static int refP6(const uint8_t *m, int i) {
+    int peak = m[i+5] > m[i+6] ? m[i+5] : m[i+6];
+    int both = 0;
+    int late = 0;
+    int k;
+
+    for (k = 10; k < 48; k++) both += m[i+k];
+    if (both * 4 < peak * 38) return 9;
+    for (k = 50; k < 83; k++) late += m[i+k];
+    return late * 2 * 38 >= both * 33 ? 84 : 49;
+}
+
+/* Control flow of the original detectMode: order number and where scanning continues */
+static int refDetect(const uint8_t *m, int i, int *next) {
+    int type;
+    int os;
+
+    *next = i + 1;
+    if (!refP1(m, i)) return 0;
+    if (refModeS(m, i)) {
+        *next = i + 50;
+        return 3;
+    }
+    if (refModeA(m, i)) {
+        type = 1;
+        os = 25;
+    } else if (refModeC(m, i)) {
+        type = 2;
+        os = 57;
+    } else {
+        return 0;
+    }
+    if (refShortP4(m, i, os)) {
+        *next = i + (os == 25 ? 28 : 60);
+        return 20 + type;
+    }
+    if (refLongP4(m, i, os)) {
+        *next = i + (os == 25 ? 30 : 62);
+        return 30 + type;
+    }
+    *next = i + (os == 25 ? 24 : 57);
+    return 10 + type;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs f until BENCH_MIN_SECONDS has passed, returns nanoseconds per sample */
+template<typename F>
+static double nsPerSample(F f, uint32_t samples) {
+    long runs = 0;
+    double start = now();
+    double elapsed;
+
+    do {
+        f();
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+    return elapsed * 1e9 / runs / samples;
+}
+
+static volatile int benchSink;
+
+/* Fixed benchmark input: I/Q data and its magnitudes */
+struct benchBuffer {
+    const char *name;
+    vector<unsigned char> iq;
+    vector<uint8_t> m;
+};
+
+static void benchInput(struct benchBuffer *b, const char *name, const struct synthConfig *c) {
+    vector<struct synthEvent> events;
+    uint32_t noise_state = c->seed * 2654435761u + 1;
+    size_t next = 0;
+
+    b->name = name;
+    b->iq.resize(2 * BENCH_SAMPLES);
+    b->m.resize(BENCH_SAMPLES + MODES_PATTERN_LEN);
+    synthEvents(c, events);
+    synthChunk(c, events, &next, 0, BENCH_SAMPLES, &noise_state, b->iq.data());
+    computeMagnitudeScalar(b->iq.data(), b->m.data(), BENCH_SAMPLES);
+}
+
+/* Random thresholds around the useful range, integer ratio tables rebuilt for them */
+static void randomThresholds(uint32_t *state) {
+    Modes.diff = synthRandom(state) * 20;
+    Modes.diffclose = synthRandom(state) * 15;
+    Modes.min_peak_amp = synthRandom(state) < 0.3 ? 0 : synthRandom(state) * 80;
+    Modes.max_noicefloor = synthRandom(state) < 0.3 ? 255 : 20 + synthRandom(state) * 100;
+    Modes.max_noicefloor_close = synthRandom(state) < 0.3 ? 255 : 20 + synthRandom(state) * 100;
+    Modes.diffratio = 0.05 + synthRandom(state) * 0.9;
+    Modes.diffratioclose = 0.2 + synthRandom(state) * 1.3;
+    Modes.diffratiop4 = 0.1 + synthRandom(state) * 0.9;
+    Modes.diffratioclosep4 = 0.5 + synthRandom(state) * 1.5;
+    populateRatioTables();
+}
+
+/* Random magnitudes: interrogations on noise of random strength, or plain random bytes */
+static void randomMagnitudes(uint32_t *state, vector<unsigned char> &iq, vector<uint8_t> &m) {
+    struct synthConfig c;
+    vector<struct synthEvent> events;
+    uint32_t n = iq.size() / 2;
+    uint32_t noise_state = *state | 1;
+    size_t next = 0;
+
+    synthDefaults(&c);
+    c.seconds = n / c.rate + 1e-3;
+    c.interrogations = 20000 + synthRandom(state) * 100000;
+    c.snr = 5 + synthRandom(state) * 40;
+    c.snr_spread = synthRandom(state) * 10;
+    c.noise = 0.5 + synthRandom(state) * 10;
+    c.overlap = synthRandom(state) * 0.3;
+    c.seed = *state;
+    synthEvents(&c, events);
+    synthChunk(&c, events, &next, 0, n, &noise_state, iq.data());
+    if (synthRandom(state) < 0.2) {
+        for (auto &v : iq) v = synthRandom(state) * 256;
+    }
+    refMagnitudeVector(iq.data(), iq.size(), m.data());
+    refZeroFixup(m.data(), n);
+}
+
+static bool mismatch(const char *what, int trial, int i) {
+    fprintf(stderr, "%s differs from the original code in trial %d at sample %d\n", what, trial, i);
+    return false;
+}
+
+/* Compares every optimized kernel against the reference code. Returns false on the first difference. */
+static bool crossCheck(int trials, uint32_t seed) {
+    struct { const char *name; magnitudeKernel kernel; } magnitude[] = {
+        { "scalar", computeMagnitudeScalar },
+#if defined(__x86_64__) || defined(__i386__)
+        { "SSE2", __builtin_cpu_supports("sse2") ? computeMagnitudeSSE2 : NULL },
+        { "AVX2", __builtin_cpu_supports("avx2") ? computeMagnitudeAVX2 : NULL },
+#endif
+    };
+    struct { const char *name; candidateKernel kernel; } candidates[] = {
+        { "scalar", computeCandidatesScalar<BENCH_RATE> },
+#if defined(__x86_64__) || defined(__i386__)
+        { "SSE2", __builtin_cpu_supports("sse2") ? computeCandidatesSSE2<BENCH_RATE> : NULL },
+        { "AVX2", __builtin_cpu_supports("avx2") ? computeCandidatesAVX2<BENCH_RATE> : NULL },
+#endif
+    };
+    uint32_t state = seed ? seed : 1;
+    long positions = 0;
+    long detections = 0;
+    int i;
+
+    /* Table differs from the original only by the zero amplitude */
+    for (i = 1; i < 129*129; i++) {
+        if (Modes.maglut[i] != refMaglut[i]) return mismatch("populateMagnitudeTable", 0, i);
+    }
+    if (Modes.maglut[0] != 1) return mismatch("populateMagnitudeTable", 0, 0);
+
+    /* A small --scale rounds many amplitudes to zero, which are stored as one */
+    free(Modes.maglut);
+    Modes.mag_scale = MODES_MAG_SCALE * 0.2;
+    populateMagnitudeTable();
+    for (i = 0; i < 129*129; i++) {
+        double v = round(sqrt((i/129)*(i/129)+(i%129)*(i%129))*Modes.mag_scale);
+        if (Modes.maglut[i] != (v > 255 ? 255 : v < 1 ? 1 : v)) return mismatch("populateMagnitudeTable --scale 0.2", 0, i);
+    }
+    for (auto &k : magnitude) {
+        if (k.kernel && !verifyMagnitudeKernel(k.kernel)) return mismatch(k.name, 0, -1);
+    }
+    free(Modes.maglut);
+    Modes.mag_scale = MODES_MAG_SCALE;
+    populateMagnitudeTable();
+
+    for (int trial = 0; trial < trials; trial++) {
+        uint32_t n = 4096 + synthRandom(&state) * 4096;
+        vector<unsigned char> iq(2 * n);
+        vector<uint8_t> expected(n + MODES_PATTERN_LEN, 0), got(n + MODES_PATTERN_LEN, 0);
+        vector<uint64_t> mask((n + 63) / 64);
+        const uint8_t *m = expected.data();
+        int end = n - benchOffsets::t.len_c + 1;
+
+        randomMagnitudes(&state, iq, expected);
+        randomThresholds(&state);
+
+        for (auto &k : magnitude) {
+            if (k.kernel == NULL) continue;
+            k.kernel(iq.data(), got.data(), n);
+            for (i = 0; i < (int) n; i++) {
+                if (got[i] != expected[i]) return mismatch(k.name, trial, i);
+            }
+        }
+
+        for (auto &k : candidates) {
+            if (k.kernel == NULL) continue;
+            k.kernel(m, end, mask.data(), currentThresholds());
+            for (i = 0; i < end; i++) {
+                if (refP1(m, i) && !(mask[i >> 6] >> (i & 63) & 1)) return mismatch(k.name, trial, i);
+            }
+        }
+
+        /* Front end against the separate kernels, after a tail of zeros */
+        vector<uint8_t> front(MODES_PATTERN_LEN + n, 0);
+        vector<uint64_t> front_mask(front.size() / 64 + 1), separate_mask(front.size() / 64 + 1);
+        int front_end = front.size() - Modes.timing.len_s + 1;
+
+        computeFrontEnd(iq.data(), n, front.data(), front_mask.data(), currentThresholds());
+        for (i = 0; i < (int) n; i++) {
+            if (front[MODES_PATTERN_LEN + i] != expected[i]) return mismatch("Front end magnitude", trial, i);
+        }
+        Modes.candidate_kernel(front.data(), front_end, separate_mask.data(), currentThresholds());
+        for (i = 0; i < front_end; i++) {
+            if ((front_mask[i >> 6] ^ separate_mask[i >> 6]) >> (i & 63) & 1) return mismatch("Front end candidates", trial, i);
+        }
+
+        for (i = 0; i < end; i++) {
+            int next;
+            int ref_next;
+            int type = detectAt<BENCH_RATE>(m, i, &next);
+
+            if (checkP1<BENCH_RATE>(m, i) != refP1(m, i)) return mismatch("P1 check", trial, i);
+            if (checkModeS<BENCH_RATE>(m, i) != refModeS(m, i)) return mismatch("Mode S preamble check", trial, i);
+            if (checkModeA<BENCH_RATE>(m, i) != refModeA(m, i)) return mismatch("Mode A P3 check", trial, i);
+            if (checkModeC<BENCH_RATE>(m, i) != refModeC(m, i)) return mismatch("Mode C P3 check", trial, i);
+            if (checkShortP4<BENCH_RATE>(m, i, benchOffsets::a3, benchOffsets::t.p4a) != refShortP4(m, i, 25) ||
+                checkShortP4<BENCH_RATE>(m, i, benchOffsets::c3, benchOffsets::t.p4c) != refShortP4(m, i, 57))
+            {
+                return mismatch("Short P4 check", trial, i);
+            }
+            if (checkLongP4<BENCH_RATE>(m, i, benchOffsets::a3, benchOffsets::t.p4a) != refLongP4(m, i, 25) ||
+                checkLongP4<BENCH_RATE>(m, i, benchOffsets::c3, benchOffsets::t.p4c) != refLongP4(m, i, 57))
+            {
+                return mismatch("Long P4 check", trial, i);
+            }
+            /* Scanning continues after P6 instead of the original fixed skip after Mode S */
+            if (type != refDetect(m, i, &ref_next) || (type != 3 && next != ref_next)) return mismatch("detectAt", trial, i);
+            if (type == 3 && next != i + refP6(m, i)) return mismatch("measureP6", trial, i);
+            if (type != 0) detections++;
+        }
+        positions += end;
+    }
+    printf("Cross-check against the original code passed: %d trials, %ld positions, %ld detections\n\n",
+        trials, positions, detections);
+    return true;
+}
+
+/* Times fn on every scanned position of the buffer */
+template<typename F>
+static double stageTime(const struct benchBuffer *b, F fn) {
+    int end = BENCH_SAMPLES - benchOffsets::t.len_c + 1;
+    const uint8_t *m = b->m.data();
+
+    return nsPerSample([&] {
+        int sum = 0;
+        for (int i = 0; i < end; i++) sum += fn(m, i);
+        benchSink = sum;
+    }, end);
+}
+
+/* Whole scan like detectMode does it without recording: candidates first, full checks on them */
+static int scanCurrent(const uint8_t *m, int end) {
+    int found = 0;
+    int i = 0;
+    int next;
+
+    Modes.candidate_kernel(m, end, Modes.candidates, currentThresholds());
+    while ((i = nextCandidate(Modes.candidates, i, end)) < end) {
+        found += detectAt<BENCH_RATE>(m, i, &next) != 0;
+        i = next;
+    }
+    return found;
+}
+
+static int scanReference(const uint8_t *m, int end) {
+    int found = 0;
+    int i = 0;
+    int next;
+
+    while (i < end) {
+        found += refDetect(m, i, &next) != 0;
+        i = next;
+    }
+    return found;
+}
+
+static void printRow(const char *name, const double *ns, int buffers) {
+    printf("%-32s", name);
+    for (int j = 0; j < buffers; j++) printf(" %12.3f", ns[j]);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    struct benchBuffer buffers[3];
+    struct synthConfig c;
+    int trials = 200;
+    uint32_t seed = 1;
+    int j;
+
+    for (j = 1; j < argc; j++) {
+        bool more = j + 1 < argc;
+
+        if (!strcmp(argv[j],"--trials") && more) {
+            trials = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--seed") && more) {
+            seed = atoi(argv[++j]);
+        } else {
+            printf("Usage: kernelbench [--trials N] [--seed N]\n"
+            "--trials           Randomized buffers compared against the original code (default 200)\n"
+            "--seed             Random seed of the comparison (default 1)\n");
+            exit(1);
+        }
+    }
+
+    modesInit();
+    refMagnitudeTable();
+    populateMagnitudeTable();
+    Modes.candidates = (uint64_t *) calloc(BENCH_SAMPLES/64 + 1, sizeof(uint64_t));
+    selectDetector(BENCH_RATE);
+    if (!crossCheck(trials, seed)) exit(1);
+
+    /* Timing runs with default thresholds */
+    modesInit();
+    populateRatioTables();
+    selectDetector(BENCH_RATE);
+
+    synthDefaults(&c);
+    c.seconds = (double) BENCH_SAMPLES / c.rate + 1e-3;
+    for (j = 0; j < SYNTH_TYPES; j++) c.mix[j] = 0;
+    benchInput(&buffers[0], "quiet", &c);
+    synthDefaults(&c);
+    c.seconds = (double) BENCH_SAMPLES / c.rate + 1e-3;
+    c.interrogations = 100000;
+    c.overlap = 0.2;
+    benchInput(&buffers[1], "dense", &c);
+    c.snr = 50;
+    c.noise = 12;
+    benchInput(&buffers[2], "saturated", &c);
+
+    printf("Magnitude kernel: %s, candidate kernel: %s\n", Modes.magnitude_kernel_name, Modes.candidate_kernel_name);
+    double start = now();
+    int calls = 0;
+    do {
+        free(Modes.maglut);
+        populateMagnitudeTable();
+        calls++;
+    } while (now() - start < BENCH_MIN_SECONDS);
+    printf("populateMagnitudeTable (with kernel verification): %.1f us per call\n\n", (now() - start) * 1e6 / calls);
+
+    printf("%-32s %12s %12s %12s\n", "ns/sample", buffers[0].name, buffers[1].name, buffers[2].name);
+    double ns[3];
+    vector<uint8_t> out(BENCH_SAMPLES);
+    int end = BENCH_SAMPLES - benchOffsets::t.len_c + 1;
+
+    for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { refMagnitudeVector(buffers[j].iq.data(), 2*BENCH_SAMPLES, out.data()); }, BENCH_SAMPLES);
+    printRow("magnitude original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { refZeroFixup(out.data(), BENCH_SAMPLES); }, BENCH_SAMPLES);
+    printRow("zero fixup original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { computeMagnitudeScalar(buffers[j].iq.data(), out.data(), BENCH_SAMPLES); }, BENCH_SAMPLES);
+    printRow("magnitude scalar", ns, 3);
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse2")) {
+        for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { computeMagnitudeSSE2(buffers[j].iq.data(), out.data(), BENCH_SAMPLES); }, BENCH_SAMPLES);
+        printRow("magnitude SSE2", ns, 3);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { computeMagnitudeAVX2(buffers[j].iq.data(), out.data(), BENCH_SAMPLES); }, BENCH_SAMPLES);
+        printRow("magnitude AVX2", ns, 3);
+    }
+#endif
+
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], refP1);
+    printRow("P1 check original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], checkP1<BENCH_RATE>);
+    printRow("P1 check", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { computeCandidatesScalar<BENCH_RATE>(buffers[j].m.data(), end, Modes.candidates, currentThresholds()); }, end);
+    printRow("P1 candidates scalar", ns, 3);
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse2")) {
+        for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { computeCandidatesSSE2<BENCH_RATE>(buffers[j].m.data(), end, Modes.candidates, currentThresholds()); }, end);
+        printRow("P1 candidates SSE2", ns, 3);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { computeCandidatesAVX2<BENCH_RATE>(buffers[j].m.data(), end, Modes.candidates, currentThresholds()); }, end);
+        printRow("P1 candidates AVX2", ns, 3);
+    }
+#endif
+
+    /* Front end with the selected kernels, magnitudes and then candidates */
+    vector<uint8_t> front(MODES_PATTERN_LEN + BENCH_SAMPLES);
+    vector<uint64_t> front_mask(front.size() / 64 + 1);
+
+    for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] {
+        computeFrontEnd(buffers[j].iq.data(), BENCH_SAMPLES, front.data(), front_mask.data(), currentThresholds()); }, BENCH_SAMPLES);
+    printRow("front end", ns, 3);
+
+    /* The remaining stages run on every position, not only where the previous stage passed */
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], refModeS);
+    printRow("Mode S preamble original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], checkModeS<BENCH_RATE>);
+    printRow("Mode S preamble", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], refModeA);
+    printRow("Mode A P3 original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], checkModeA<BENCH_RATE>);
+    printRow("Mode A P3", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], refModeC);
+    printRow("Mode C P3 original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], checkModeC<BENCH_RATE>);
+    printRow("Mode C P3", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], [](const uint8_t *m, int i) { return refShortP4(m, i, 25); });
+    printRow("short P4 original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], [](const uint8_t *m, int i) {
+        return checkShortP4<BENCH_RATE>(m, i, benchOffsets::a3, benchOffsets::t.p4a); });
+    printRow("short P4", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], [](const uint8_t *m, int i) { return refLongP4(m, i, 25); });
+    printRow("long P4 original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = stageTime(&buffers[j], [](const uint8_t *m, int i) {
+        return checkLongP4<BENCH_RATE>(m, i, benchOffsets::a3, benchOffsets::t.p4a); });
+    printRow("long P4", ns, 3);
+
+    for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { benchSink = scanReference(buffers[j].m.data(), end); }, end);
+    printRow("full scan original", ns, 3);
+    for (j = 0; j < 3; j++) ns[j] = nsPerSample([&] { benchSink = scanCurrent(buffers[j].m.data(), end); }, end);
+    printRow("full scan", ns, 3);
+    return 0;
+}